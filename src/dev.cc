@@ -17,13 +17,13 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
 #include <limits.h>
-#include <vector>
-#include <string>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -31,42 +31,329 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <termios.h>
 #include "dev.h"
 #include "timer.h"
-
-struct CustStat {
-	int id;
-	time_t start, end;
-};
+#include "logger.h"
+#include "journal.h"
+#include "trace.h"
+#include "metrics.h"
 
 #define TMHIST_SIZE		16
 
-void post_redisplay();	// defined in main.cc
+/* responses about queue 0 are the same as before there were multiple queues,
+ * the rest add the queue number: "ticket: 5" vs "ticket 2: 5"
+ */
+#define QFMT		"%s%.0d"
+#define QARG(q)		(q) ? " " : "", (q)
+
+Device::Device()
+{
+	fd = slave_fd = -1;
+	line_start = line_end = scan_pos = 0;
+	skip_line = false;
+	input_stalled = false;
+	binary = false;
+	skip_lf = false;
+	cur_reqid = 0;
+	out_start = out_end = 0;
+	memset(&iostat, 0, sizeof iostat);
+	journal = 0;
+	wall_offset = 0;
+	trace = 0;
+	metrics = 0;
+	report_inputs = cmd_echo = 0;
+	queues = 0;
+	num_queues = 0;
+	retention = 0;
+	set_num_queues(1);
+	watch = 0;
+	change_func = 0;
+	change_cls = 0;
+	output_func = 0;
+	output_cls = 0;
+}
+
+Device::~Device()
+{
+	close_journal();
+	close_trace();
+	stop();
+	delete [] queues;
+}
+
+void Device::set_retention(int count)
+{
+	retention = count;
+	for(int i=0; i<num_queues; i++) {
+		queues[i].cstat.set_retention(count);
+	}
+}
+
+bool Device::set_num_queues(int count)
+{
+	if(count < 1 || count > MAX_QUEUES) {
+		return false;
+	}
+
+	delete [] queues;
+	queues = new DevQueue[count];
+	num_queues = count;
+
+	for(int i=0; i<count; i++) {
+		queues[i].customer = queues[i].ticket = 0;
+		queues[i].last_ticket_usec = -1;
+		if(retention > 0) {
+			queues[i].cstat.set_retention(retention);
+		}
+	}
+	num_waiting = 0;
+	return true;
+}
+
+int Device::get_num_queues() const
+{
+	return num_queues;
+}
+
+bool Device::open_journal(const char *path)
+{
+	close_journal();
+
+	JournalState st;
+	journal = new Journal;
+	if(!journal->open(path, &st)) {
+		delete journal;
+		journal = 0;
+		return false;
+	}
+	wall_offset = (long)(get_wall_usec() - get_time_usec());
+
+	/* keep every queue the journal knows about, even if we're now configured
+	 * for fewer of them. The records aren't checksummed, so check that every
+	 * one of them is something we can replay before touching any queue.
+	 */
+	int nq = st.queues.size();
+	int num_rec = journal->get_num_records();
+	for(int i=0; i<num_rec; i++) {
+		const JournalRec *rec = journal->get_record(i);
+
+		if(rec->type != JREC_ISSUE && rec->type != JREC_NEXT && rec->type != JREC_RESET) {
+			log_error("%s: invalid journal, record %d has unknown type %u", path, i, (unsigned int)rec->type);
+			close_journal();
+			return false;
+		}
+		if(rec->aux == JREC_ALL_QUEUES) {
+			if(rec->type != JREC_RESET) {
+				log_error("%s: invalid journal, record %d applies to all queues", path, i);
+				close_journal();
+				return false;
+			}
+			continue;
+		}
+		if(rec->aux >= MAX_QUEUES) {
+			log_error("%s: invalid journal, record %d is for queue %u", path, i, (unsigned int)rec->aux);
+			close_journal();
+			return false;
+		}
+		if((int)rec->aux >= nq) {
+			nq = rec->aux + 1;
+		}
+	}
+	if(nq > MAX_QUEUES) {
+		log_error("%s: invalid journal, %d queues", path, nq);
+		close_journal();
+		return false;
+	}
+	if(nq > num_queues) {
+		log_warning("%s: journal has %d queues, more than the %d configured", path, nq, num_queues);
+	}
+	set_num_queues(nq > num_queues ? nq : num_queues);
+
+	/* restore the snapshot */
+	for(size_t i=0; i<st.queues.size(); i++) {
+		const JournalQueueState &qst = st.queues[i];
+		DevQueue *q = queues + i;
+
+		q->customer = qst.customer;
+		q->ticket = qst.ticket;
+		q->wstat = qst.wstat;
+		for(size_t j=0; j<qst.waiting.size(); j++) {
+			q->cstat.add(qst.waiting[j].id, qst.waiting[j].start - wall_offset);
+		}
+		num_waiting += q->ticket - q->customer;
+	}
+
+	/* and replay the journal on top of it */
+	for(int i=0; i<num_rec; i++) {
+		const JournalRec *rec = journal->get_record(i);
+		long usec = (long)rec->time - wall_offset;
+		int qidx = rec->aux;
+
+		switch(rec->type) {
+		case JREC_ISSUE:
+			queues[qidx].ticket = rec->id - 1;
+			add_ticket(qidx, usec);
+			break;
+
+		case JREC_NEXT:
+			queues[qidx].customer = rec->id - 1;
+			serve_customer(qidx, usec);
+			break;
+
+		case JREC_RESET:
+			if(rec->aux == JREC_ALL_QUEUES) {
+				for(int j=0; j<num_queues; j++) {
+					reset_queue(j);
+				}
+			} else {
+				reset_queue(qidx);
+			}
+			break;
+		}
+	}
+	for(int i=0; i<num_queues; i++) {
+		queues[i].last_ticket_usec = -1;
+	}
+
+	log_info("%s: restored the state of %d queues (%d customers waiting) from %d journal records",
+			path, num_queues, num_waiting, num_rec);
+	return true;
+}
+
+void Device::close_journal()
+{
+	if(!journal) return;
+
+	/* leave a fresh snapshot behind, to make the next startup faster */
+	write_snapshot();
+	delete journal;
+	journal = 0;
+}
+
+void Device::journal_event(int type, int q, int id)
+{
+	/* the same clock the statistics are based on, so replaying the journal
+	 * reproduces them exactly.
+	 */
+	journal->append(type, q, id, get_now_usec() + wall_offset);
+	if(journal->is_full()) {
+		write_snapshot();
+	}
+}
+
+void Device::write_snapshot()
+{
+	JournalState st;
+	st.queues.resize(num_queues);
+
+	for(int i=0; i<num_queues; i++) {
+		DevQueue *q = queues + i;
+		JournalQueueState *qst = &st.queues[i];
+
+		qst->customer = q->customer;
+		qst->ticket = q->ticket;
+		qst->wstat = q->wstat;
+
+		for(int j=q->customer + 1; j<=q->ticket; j++) {
+			CustStat *cs = q->cstat.find(j);
+			if(cs) {
+				CustStat wcs = *cs;
+				wcs.start += wall_offset;
+				qst->waiting.push_back(wcs);
+			}
+		}
+	}
+
+	journal->snapshot(st);
+}
+
+bool Device::open_trace(const char *path)
+{
+	close_trace();
 
-int customer, ticket;
-static int report_inputs, cmd_echo;
-static long last_ticket_msec = LONG_MIN;
+	trace = new TraceWriter;
+	if(!trace->open(path, get_now_usec(), num_queues, retention)) {
+		delete trace;
+		trace = 0;
+		return false;
+	}
+	return true;
+}
 
-static std::vector<CustStat> cstat;
+void Device::close_trace()
+{
+	delete trace;
+	trace = 0;
+}
 
-time_t calc_avg_wait();
-static void runcmd(const char *cmd);
+void Device::set_metrics(MetricsDev *m)
+{
+	metrics = m;
+	if(metrics) {
+		publish_io_metrics();
+		metric_set(&metrics->queue_depth, (int64_t)num_waiting);
+	}
+}
 
-static int fd = -1;
-static FILE *fp;
-static std::string cur_line;
+void Device::publish_io_metrics()
+{
+	metric_set(&metrics->bytes_in, iostat.bytes_in);
+	metric_set(&metrics->bytes_out, iostat.bytes_out);
+	metric_set(&metrics->bytes_dropped, iostat.bytes_dropped);
+}
 
-int start_dev(const char *devpath)
+int Device::start(const char *devpath)
 {
 	if((fd = open(devpath, O_RDWR | O_NONBLOCK)) == -1) {
 		fprintf(stderr, "failed to open device: %s: %s\n", devpath, strerror(errno));
 		return -1;
 	}
+	path = devpath;
+
+	if(!setup(fd)) {
+		stop();
+		return -1;
+	}
+	return fd;
+}
+
+int Device::start_pty()
+{
+	const char *slave_name;
+
+	if((fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+		perror("failed to allocate pseudoterminal");
+		return -1;
+	}
+	if(grantpt(fd) == -1 || unlockpt(fd) == -1 || !(slave_name = ptsname(fd))) {
+		perror("failed to set up pseudoterminal");
+		stop();
+		return -1;
+	}
+	path = slave_name;
+
+	/* keep the slave side open ourselves, otherwise the master reports a
+	 * hangup whenever the host program closes the port.
+	 */
+	if((slave_fd = open(slave_name, O_RDWR | O_NOCTTY)) == -1) {
+		fprintf(stderr, "failed to open pseudoterminal slave: %s: %s\n", slave_name, strerror(errno));
+		stop();
+		return -1;
+	}
+
+	if(!setup(fd)) {
+		stop();
+		return -1;
+	}
+	return fd;
+}
+
+bool Device::setup(int fd)
+{
 	if(isatty(fd)) {
 		struct termios term;
 
 		if(tcgetattr(fd, &term) == -1) {
 			perror("failed to retrieve terminal attributes");
-			stop_dev();
-			return -1;
+			return false;
 		}
 		term.c_cflag = CS8 | CLOCAL;
 		term.c_iflag &= ~(IXON | IXOFF);
@@ -77,192 +364,706 @@ int start_dev(const char *devpath)
 
 		if(tcsetattr(fd, TCSANOW, &term) == -1) {
 			perror("failed to set terminal attributes");
-			stop_dev();
-			return -1;
+			return false;
 		}
 	}
+	return true;
+}
 
-	if(!(fp = fdopen(fd, "r+"))) {
-		perror("failed to attach an I/O stream to the device file\n");
-		stop_dev();
-		return -1;
+void Device::stop()
+{
+	if(fd >= 0) {
+		close(fd);
+	}
+	if(slave_fd >= 0) {
+		close(slave_fd);
 	}
-	setvbuf(fp, 0, _IONBF, 0);
+	fd = slave_fd = -1;
+}
 
+int Device::get_fd() const
+{
 	return fd;
 }
 
-void stop_dev()
+const char *Device::get_path() const
 {
-	if(fp)
-		fclose(fp);
-	else if(fd >= 0)
-		close(fd);
+	return path.c_str();
 }
 
+void Device::changed()
+{
+	if(metrics) {
+		metric_set(&metrics->queue_depth, (int64_t)num_waiting);
+	}
+	if(change_func) {
+		change_func(this, change_cls);
+	}
+}
 
-void proc_dev_input()
+
+/* Reads everything available into linebuf, and dispatches every complete
+ * line in place. Only the trailing partial line (if any) is moved back to the
+ * start of the buffer before the next read, so lines split across reads are
+ * reassembled without any allocations.
+ */
+void Device::proc_input()
 {
 	int rdbytes;
-	char buf[256];
-	static bool skip_line;
 
-	while((rdbytes = read(fd, buf, sizeof buf - 1)) > 0) {
-		buf[rdbytes] = 0;
+	input_stalled = false;
+
+	for(;;) {
+		if(!proc_buffered()) {
+			input_stalled = true;
+			break;
+		}
+		compact_input();
+
+		if(fd < 0 || (rdbytes = read(fd, linebuf + line_end, LINEBUF_SIZE - line_end)) <= 0) {
+			break;
+		}
+		if(trace) {
+			trace->write(TRACE_IN, get_now_usec(), linebuf + line_end, rdbytes);
+		}
+		line_end += rdbytes;
+		iostat.bytes_in += rdbytes;
+	}
+}
+
+int Device::feed(const char *buf, int len)
+{
+	int consumed = 0;
+
+	input_stalled = false;
+
+	for(;;) {
+		if(!proc_buffered()) {
+			input_stalled = true;
+			break;
+		}
+		compact_input();
+
+		int sz = LINEBUF_SIZE - line_end;
+		if(sz > len - consumed) {
+			sz = len - consumed;
+		}
+		if(sz <= 0) break;
+
+		memcpy(linebuf + line_end, buf + consumed, sz);
+		line_end += sz;
+		consumed += sz;
+		iostat.bytes_in += sz;
+	}
+	return consumed;
+}
+
+/* moves the unprocessed input to the start of linebuf, to make room for more */
+void Device::compact_input()
+{
+	if(line_start > 0) {
+		line_end -= line_start;
+		scan_pos -= line_start;
+		if(line_end) {
+			memmove(linebuf, linebuf + line_start, line_end);
+		}
+		line_start = 0;
+	}
+	if(line_end >= LINEBUF_SIZE) {
+		/* no line terminator in a full buffer, drop the whole line */
+		line_end = scan_pos = 0;
+		skip_line = true;
+	}
+}
+
+/* dispatches every complete command in linebuf, switching between the text
+ * and binary parsers whenever a command changes the protocol mode. returns
+ * false if it had to stop because the output queue is backlogged.
+ */
+bool Device::proc_buffered()
+{
+	for(;;) {
+		bool was_binary = binary;
+
+		if(!(binary ? proc_frames() : proc_lines())) {
+			return false;
+		}
+		if(binary == was_binary) {
+			return true;
+		}
+	}
+}
+
+/* the following two return true when they run out of complete commands, or
+ * when the protocol mode changes.
+ */
+bool Device::proc_lines()
+{
+	char *ptr = linebuf + scan_pos;
+	char *end = linebuf + line_end;
+	char *nl = 0;
 
-		/* ignore our own crap */
-		if(memcmp(buf, "OK,", 3) == 0 || memcmp(buf, "ERR,", 4) == 0) {
-			skip_line = true;
+	while(ptr < end) {
+		if(output_backlogged()) {
+			scan_pos = ptr - linebuf;
+			return false;
 		}
 
-		for(int i=0; i<rdbytes; i++) {
-			if(buf[i] == '\n' || buf[i] == '\r') {
-				if(!cur_line.empty()) {
-					runcmd(cur_line.c_str());
-					cur_line.clear();
+		if(!nl || nl < ptr) {
+			if(!(nl = (char*)memchr(ptr, '\n', end - ptr))) {
+				nl = end;
+			}
+		}
+		/* a lone CR also terminates a line */
+		char *term = (char*)memchr(ptr, '\r', nl - ptr);
+		if(!term) {
+			if(nl == end) break;
+			term = nl;
+		}
+
+		proc_line(linebuf + line_start, term - linebuf - line_start);
+		ptr = term + 1;
+		line_start = ptr - linebuf;
+
+		if(binary) {
+			/* what follows is binary frames, skip the LF of a CRLF pair, or
+			 * leave it to proc_frames if it hasn't arrived yet
+			 */
+			if(*term == '\r') {
+				if(ptr == end) {
+					skip_lf = true;
+				} else if(*ptr == '\n') {
+					line_start++;
 				}
-				skip_line = false;
-			} else {
-				if(!skip_line) {
-					cur_line.push_back(buf[i]);
+			}
+			scan_pos = line_start;
+			return true;
+		}
+	}
+
+	scan_pos = line_end;
+	return true;
+}
+
+bool Device::proc_frames()
+{
+	if(skip_lf && line_end > line_start) {
+		if(linebuf[line_start] == '\n') {
+			line_start++;
+		}
+		skip_lf = false;
+	}
+
+	/* the length alone is enough to tell a text line from a frame */
+	while(line_end - line_start >= 2) {
+		if(output_backlogged()) {
+			return false;
+		}
+
+		unsigned char *hdr = (unsigned char*)linebuf + line_start;
+		int len = hdr[0] | (hdr[1] << 8);
+
+		if(len < BIN_REQ_HDR_SIZE - 2 || len > BIN_MAX_FRAME) {
+			/* we can't find the next frame boundary, give up on binary mode,
+			 * and parse the same bytes as text. Any text line starting with
+			 * two printable characters gets here, so a host which doesn't
+			 * know what mode we're in can always send a b0 or b1 line.
+			 */
+			binary = false;
+			scan_pos = line_start;
+			send("ERR,invalid binary frame length %d, back to text mode\n", len);
+			return true;
+		}
+		if(line_end - line_start < len + 2) {
+			break;	/* partial frame */
+		}
+
+		cur_reqid = (unsigned long)hdr[2] | ((unsigned long)hdr[3] << 8) |
+			((unsigned long)hdr[4] << 16) | ((unsigned long)hdr[5] << 24);
+		int cmdlen = len + 2 - BIN_REQ_HDR_SIZE;
+		if(cmdlen > 0) {
+			runcmd(linebuf + line_start + BIN_REQ_HDR_SIZE, cmdlen);
+		} else {
+			send("ERR,empty command\n");
+		}
+		cur_reqid = 0;
+		line_start += len + 2;
+
+		if(!binary) {
+			scan_pos = line_start;
+			return true;
+		}
+	}
+
+	scan_pos = line_end;
+	return true;
+}
+
+void Device::proc_line(const char *line, int len)
+{
+	if(skip_line) {
+		skip_line = false;
+		return;
+	}
+	if(!len) return;
+
+	/* ignore our own crap */
+	if((len >= 3 && memcmp(line, "OK,", 3) == 0) || (len >= 4 && memcmp(line, "ERR,", 4) == 0)) {
+		return;
+	}
+	runcmd(line, len);
+}
+
+bool Device::is_input_stalled() const
+{
+	return input_stalled;
+}
+
+/* queues a formatted message for output. Messages are queued whole or not at
+ * all, so a full queue never leaves a truncated line behind. In binary mode
+ * the message is wrapped in a response frame.
+ */
+void Device::send(const char *fmt, ...)
+{
+	int hdrsz = binary ? BIN_RESP_HDR_SIZE : 0;
+
+	if(out_start > 0) {
+		/* move the pending output to the start, to make room */
+		out_end -= out_start;
+		if(out_end) {
+			memmove(outbuf, outbuf + out_start, out_end);
+		}
+		out_start = 0;
+	}
+
+	va_list ap;
+	va_start(ap, fmt);
+	int avail = OUTBUF_SIZE - out_end - hdrsz;
+	int len = avail > 0 ? vsnprintf(outbuf + out_end + hdrsz, avail, fmt, ap) : vsnprintf(0, 0, fmt, ap);
+	va_end(ap);
+
+	if(len < 0) return;
+	if(len >= avail) {
+		iostat.bytes_dropped += hdrsz + len;
+		return;
+	}
+
+	if(binary) {
+		len = make_frame(outbuf + out_end, len);
+	}
+	out_end += len;
+	iostat.bytes_queued += len;
+}
+
+/* turns the text response following the frame header space into a binary
+ * response frame in place. returns the size of the whole frame.
+ */
+int Device::make_frame(char *frame, int textlen)
+{
+	char *text = frame + BIN_RESP_HDR_SIZE;
+	unsigned long id = cur_reqid;
+	int status, skip = 0;
+
+	if(textlen >= 3 && memcmp(text, "OK,", 3) == 0) {
+		status = BIN_STATUS_OK;
+		skip = 3;
+	} else if(textlen >= 4 && memcmp(text, "ERR,", 4) == 0) {
+		status = BIN_STATUS_ERR;
+		skip = 4;
+	} else {
+		status = BIN_STATUS_REPORT;
+		id = 0;
+	}
+
+	while(textlen > skip && (text[textlen - 1] == '\n' || text[textlen - 1] == '\r')) {
+		textlen--;
+	}
+	textlen -= skip;
+	if(skip && textlen) {
+		memmove(text, text + skip, textlen);
+	}
+
+	int len = BIN_RESP_HDR_SIZE - 2 + textlen;
+	unsigned char *hdr = (unsigned char*)frame;
+	hdr[0] = len & 0xff;
+	hdr[1] = (len >> 8) & 0xff;
+	hdr[2] = id & 0xff;
+	hdr[3] = (id >> 8) & 0xff;
+	hdr[4] = (id >> 16) & 0xff;
+	hdr[5] = (id >> 24) & 0xff;
+	hdr[6] = status;
+	return len + 2;
+}
+
+bool Device::flush()
+{
+	while(out_start < out_end) {
+		if(output_func) {
+			output_func(this, outbuf + out_start, out_end - out_start, output_cls);
+			iostat.bytes_out += out_end - out_start;
+			out_start = out_end;
+			break;
+		}
+		if(fd < 0) {
+			/* standalone device, nowhere to send it */
+			out_start = out_end;
+			break;
+		}
+
+		int wrbytes = write(fd, outbuf + out_start, out_end - out_start);
+		if(wrbytes == -1) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				if(metrics) {
+					publish_io_metrics();
 				}
+				return false;
 			}
+			iostat.bytes_dropped += out_end - out_start;
+			out_start = out_end;
+			break;
 		}
+		if(trace) {
+			trace->write(TRACE_OUT, get_now_usec(), outbuf + out_start, wrbytes);
+		}
+		out_start += wrbytes;
+		iostat.bytes_out += wrbytes;
 	}
+
+	out_start = out_end = 0;
+	if(metrics) {
+		publish_io_metrics();
+	}
+	return true;
+}
+
+bool Device::output_pending() const
+{
+	return out_start < out_end;
 }
 
-void issue_ticket()
+bool Device::output_backlogged() const
 {
-	ticket++;
-	last_ticket_msec = get_msec();
+	return out_end - out_start > OUTBUF_HIGH_WATER;
+}
 
-	CustStat st;
-	st.id = ticket;
-	st.start = time(0);
-	st.end = (time_t)-1;
-	cstat.push_back(st);
+const DevIOStats &Device::get_io_stats() const
+{
+	return iostat;
+}
+
+int Device::get_ticket(int q) const
+{
+	return queues[q].ticket;
+}
+
+int Device::get_customer(int q) const
+{
+	return queues[q].customer;
+}
 
+void Device::issue_ticket(int q)
+{
+	add_ticket(q, get_now_usec());
+	if(journal) {
+		journal_event(JREC_ISSUE, q, queues[q].ticket);
+	}
+	if(metrics) {
+		metric_add(&metrics->tickets, 1);
+	}
 
 	if(report_inputs) {
-		fprintf(fp, "ticket: %d\n", ticket);
+		send("ticket" QFMT ": %d\n", QARG(q), queues[q].ticket);
 	}
 
-	post_redisplay();
+	changed();
 }
 
-void next_customer()
+void Device::add_ticket(int qidx, long usec)
 {
-	if(customer < ticket) {
-		customer++;
-		last_ticket_msec = LONG_MIN;
+	DevQueue *q = queues + qidx;
 
-		for(size_t i=0; i<cstat.size(); i++) {
-			if(cstat[i].id == customer) {
-				cstat[i].end = time(0);
-				fprintf(stderr, "start/end/interval: %lu %lu %lu\n", cstat[i].start,
-						cstat[i].end, cstat[i].end - cstat[i].start);
-				break;
-			}
+	q->ticket++;
+	q->last_ticket_usec = usec;
+	num_waiting++;
+
+	q->cstat.add(q->ticket, usec);
+}
+
+void Device::next_customer(int q)
+{
+	if(serve_customer(q, get_now_usec())) {
+		if(journal) {
+			journal_event(JREC_NEXT, q, queues[q].customer);
+		}
+		if(metrics) {
+			metric_add(&metrics->served, 1);
 		}
 
 		if(report_inputs) {
-			fprintf(fp, "customer: %d\n", customer);
+			send("customer" QFMT ": %d\n", QARG(q), queues[q].customer);
 		}
 
-		post_redisplay();
+		changed();
 	}
 }
 
-time_t calc_avg_wait()
+bool Device::serve_customer(int qidx, long usec)
+{
+	DevQueue *q = queues + qidx;
+
+	if(q->customer >= q->ticket) {
+		return false;
+	}
+
+	q->customer++;
+	q->last_ticket_usec = -1;
+	num_waiting--;
+
+	CustStat *st = q->cstat.find(q->customer);
+	if(st) {
+		st->end = usec;
+		q->wstat.add(st->end - st->start);
+		log_debug("queue %d customer %d start/end/interval: %ld %ld %ld", qidx, q->customer,
+				st->start, st->end, st->end - st->start);
+	}
+	return true;
+}
+
+void Device::reset_queue(int qidx)
+{
+	DevQueue *q = queues + qidx;
+
+	num_waiting -= q->ticket - q->customer;
+	q->customer = 0;
+	q->ticket = 0;
+	q->last_ticket_usec = -1;
+	q->cstat.clear();	/* ticket ids start over */
+}
+
+/* in seconds, as reported by the 'a' command */
+time_t Device::calc_avg_wait(int q) const
+{
+	return (time_t)(queues[q].wstat.get_mean() / 1000000.0);
+}
+
+const WaitStats &Device::get_wait_stats(int q) const
+{
+	return queues[q].wstat;
+}
+
+/* wait times are kept in usec, and reported in msec */
+#define MSEC(x)	((double)(x) / 1000.0)
+
+void Device::print_wait_stats(int q)
+{
+	const WaitStats &ws = queues[q].wstat;
+
+	send("OK,wait stats" QFMT ": count=%lu mean=%.3f min=%.3f max=%.3f p50=%.3f p90=%.3f p99=%.3f msec\r\n",
+			QARG(q), (unsigned long)ws.get_count(), MSEC(ws.get_mean()),
+			MSEC(ws.get_min()), MSEC(ws.get_max()),
+			MSEC(ws.get_percentile(50)), MSEC(ws.get_percentile(90)),
+			MSEC(ws.get_percentile(99)));
+}
+
+/* argument is what follows the 'p' command: the percentile and optionally
+ * the queue, e.g. "99.9" or "99.9@2".
+ */
+void Device::print_percentile(const char *arg, int len)
 {
-	int count = 0;
-	time_t sum = 0;
+	char buf[32];
+	char *endp;
+	int q = 0;
 
-	for(size_t i=0; i<cstat.size(); i++) {
-		if(cstat[i].end != (time_t)-1) {
-			sum += cstat[i].end - cstat[i].start;
-			count++;
+	const char *at = (const char*)memchr(arg, '@', len);
+	if(at) {
+		if((q = parse_queue(at + 1, arg + len - at - 1)) == -1) {
+			return;
 		}
+		len = at - arg;
+	}
+
+	if(len <= 0) {
+		send("ERR,expected percentile: p<0-100>[@queue]\n");
+		return;
+	}
+	if(len >= (int)sizeof buf) {
+		len = sizeof buf - 1;
+	}
+	memcpy(buf, arg, len);
+	buf[len] = 0;
+
+	/* like the queue number, anything after the percentile is ignored */
+	double p = strtod(buf, &endp);
+	if(endp == buf || !(p >= 0.0 && p <= 100.0)) {
+		send("ERR,invalid percentile: %s\n", buf);
+		return;
 	}
+	*endp = 0;
+	send("OK,p%s wait time" QFMT ": %.3f msec\r\n", buf, QARG(q),
+			MSEC(queues[q].wstat.get_percentile(p)));
+}
 
-	return count ? sum / count : 0;
+/* queue number following a command, 0 if there isn't one. Only the digits
+ * right after the command letter count, anything after them is ignored, like
+ * everything after the command letter always was. If the queue doesn't exist
+ * it queues an error response, and returns -1.
+ */
+int Device::parse_queue(const char *arg, int len)
+{
+	int q = 0, ndigits = 0;
+
+	while(ndigits < len && arg[ndigits] >= '0' && arg[ndigits] <= '9') {
+		if(q < num_queues) {
+			q = q * 10 + arg[ndigits] - '0';
+		}
+		ndigits++;
+	}
+	if(q >= num_queues) {
+		send("ERR,invalid queue: %.*s\n", ndigits, arg);
+		return -1;
+	}
+	return q;
 }
 
-#define TICKET_SHOW_DUR		1000
+/* the display and LEDs show queue 0 */
+#define TICKET_SHOW_DUR		1000000		/* usec */
+
+bool Device::showing_ticket() const
+{
+	long last = queues[0].last_ticket_usec;
+	return last >= 0 && (long)get_now_usec() - last < TICKET_SHOW_DUR;
+}
 
-int get_display_number()
+int Device::get_display_number() const
 {
-	if(get_msec() - last_ticket_msec < TICKET_SHOW_DUR) {
-		return ticket;
+	if(showing_ticket()) {
+		return queues[0].ticket;
 	}
-	return customer;
+	return queues[0].customer;
 }
 
-int get_led_state(int led)
+int Device::get_led_state(int led) const
 {
-	int ledon = get_msec() - last_ticket_msec < TICKET_SHOW_DUR ? 0 : 1;
+	int ledon = showing_ticket() ? 0 : 1;
 	return led == ledon ? 1 : 0;
 }
 
+uint64_t Device::get_state_expiry() const
+{
+	return showing_ticket() ? queues[0].last_ticket_usec + TICKET_SHOW_DUR : 0;
+}
+
 #define VERSTR \
 	"Queue system emulator v0.1"
 
-static void runcmd(const char *cmd)
+void Device::runcmd(const char *cmd, int len)
 {
-	printf("DBG: runcmd(\"%s\")\n", cmd);
+	int q;
+
+	log_debug("runcmd(\"%.*s\")", len, cmd);
+
+	if(metrics) {
+		int idx = cmd[0] >= 'a' && cmd[0] <= 'z' ? cmd[0] - 'a' : METRICS_NUM_CMDS - 1;
+		metric_add(&metrics->cmds[idx], 1);
+	}
 
 	switch(cmd[0]) {
+	case 'b':
+		/* b1 (or just b) selects the binary protocol, b0 the text protocol.
+		 * The reply goes out in the old mode, and selecting the mode we're
+		 * already in is harmless, so a host can always send the one it wants.
+		 */
+		if(len > 1 && cmd[1] > '1' && cmd[1] <= '9') {
+			send("ERR,invalid protocol: %c, expected b0 (text) or b1 (binary)\n", cmd[1]);
+		} else if(len > 1 && cmd[1] == '0') {
+			send("OK,switching to text protocol\n");
+			binary = false;
+		} else {
+			send("OK,switching to binary protocol\n");
+			binary = true;
+		}
+		break;
+
 	case 'e':
 		cmd_echo = !cmd_echo;
-		fprintf(fp, "OK,turning echo %s\n", cmd_echo ? "on" : "off");
+		send("OK,turning echo %s\n", cmd_echo ? "on" : "off");
 		break;
 
 	case 'i':
 		report_inputs = !report_inputs;
-		fprintf(fp, "OK,turning input reports %s\n", report_inputs ? "on" : "off");
+		send("OK,turning input reports %s\n", report_inputs ? "on" : "off");
 		break;
 
 	case 'v':
-		fprintf(fp, "OK,%s\n", VERSTR);
+		send("OK,%s\n", VERSTR);
 		break;
 
 	case 'r':
-		fprintf(fp, "OK,reseting queues\n");
-		customer = 0;
-		ticket = 0;
-		last_ticket_msec = LONG_MIN;
-		post_redisplay();
+		/* without a queue number, all of them */
+		if(len == 1 || cmd[1] < '0' || cmd[1] > '9') {
+			send("OK,reseting queues\n");
+			for(int i=0; i<num_queues; i++) {
+				reset_queue(i);
+			}
+			q = JREC_ALL_QUEUES;
+		} else {
+			if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+			send("OK,reseting queue %d\n", q);
+			reset_queue(q);
+		}
+		if(journal) {
+			journal_event(JREC_RESET, q, 0);
+		}
+		changed();
 		break;
 
 	case 't':
-		fprintf(fp, "OK,ticket: %d\r\n", ticket);
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		send("OK,ticket" QFMT ": %d\r\n", QARG(q), queues[q].ticket);
 		break;
 
 	case 'c':
-		fprintf(fp, "OK,customer: %d\r\n", customer);
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		send("OK,customer" QFMT ": %d\r\n", QARG(q), queues[q].customer);
 		break;
 
 	case 'q':
-		fprintf(fp, "OK,issuing queue ticket\n");
-		issue_ticket();
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		send("OK,issuing queue ticket\n");
+		issue_ticket(q);
 		break;
 
 	case 'n':
-		fprintf(fp, "OK,next customer\n");
-		next_customer();
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		send("OK,next customer\n");
+		next_customer(q);
 		break;
 
 	case 'a':
-		fprintf(fp, "OK,avg wait time: %lu\r\n", (unsigned long)calc_avg_wait());
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		send("OK,avg wait time" QFMT ": %lu\r\n", QARG(q), (unsigned long)calc_avg_wait(q));
+		break;
+
+	case 's':
+		if((q = parse_queue(cmd + 1, len - 1)) == -1) break;
+		print_wait_stats(q);
+		break;
+
+	case 'p':
+		print_percentile(cmd + 1, len - 1);
 		break;
 
 	case 'h':
-		fprintf(fp, "OK,commands: (e)cho, (v)ersion, (t)icket, (c)ustomer, "
-				"(n)ext, (q)ueue, (a)verage wait time, (r)eset, (i)nput-reports, "
-				"(h)elp.\n");
+		send("OK,commands: (e)cho, (v)ersion, (t)icket, (c)ustomer, "
+				"(n)ext, (q)ueue, (a)verage wait time, wait (s)tats, "
+				"(p)ercentile <0-100>, (r)eset, (i)nput-reports, (b)inary protocol, "
+				"(h)elp. t/c/n/q/a/s/r take an optional queue number (default: 0, "
+				"r: all), p takes it as p<0-100>@<queue>. b1 selects the binary "
+				"protocol, b0 the text protocol.\n");
 		break;
 
 	default:
-		fprintf(fp, "ERR,unknown command: %s\n", cmd);
+		send("ERR,unknown command: %.*s\n", len, cmd);
 	}
 }
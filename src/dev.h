@@ -19,16 +19,201 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef DEV_H_
 #define DEV_H_
 
-extern int customer, ticket;
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include "tstore.h"
+#include "waitstat.h"
 
-int start_dev(const char *devpath);
-void stop_dev();
-void proc_dev_input();
+#define MAX_QUEUES		256
 
-void next_customer();
-void issue_ticket();
+struct EvWatch;
+class Journal;
+class TraceWriter;
+struct MetricsDev;
 
-int get_display_number();
-int get_led_state(int led);
+#define LINEBUF_SIZE	4096
+#define OUTBUF_SIZE		16384
+/* stop processing input while more than this much output is waiting */
+#define OUTBUF_HIGH_WATER	(OUTBUF_SIZE / 2)
+
+/* binary protocol framing, all fields little-endian:
+ * request:  u16 length, u32 request id, command bytes
+ * response: u16 length, u32 request id, u8 status, message bytes
+ * length counts the bytes following the length field itself.
+ */
+#define BIN_REQ_HDR_SIZE	6
+#define BIN_RESP_HDR_SIZE	7
+#define BIN_MAX_FRAME		(LINEBUF_SIZE - 2)
+
+enum {
+	BIN_STATUS_OK,
+	BIN_STATUS_ERR,
+	BIN_STATUS_REPORT	/* unsolicited input report, request id 0 */
+};
+
+struct DevIOStats {
+	unsigned long bytes_in;
+	unsigned long bytes_out;		/* written to the device */
+	unsigned long bytes_queued;		/* accepted into the output queue */
+	unsigned long bytes_dropped;	/* lost to a full queue or write errors */
+};
+
+/* state of one of the independent queues of a device */
+struct DevQueue {
+	int customer, ticket;
+	long last_ticket_usec;	/* -1 after the ticket display times out */
+
+	TicketStore cstat;
+	/* wait times (usec) of every customer served, evicted from cstat or not */
+	WaitStats wstat;
+};
+
+/* A single emulated queue device. Each instance owns its serial port (or
+ * pseudoterminal), its command parser state and its customer statistics, so
+ * any number of them can be driven from the same process.
+ */
+class Device {
+private:
+	int fd, slave_fd;
+	std::string path;
+
+	/* input line framing: unprocessed bytes are linebuf[line_start, line_end),
+	 * of which everything before scan_pos is known to be a partial line.
+	 */
+	char linebuf[LINEBUF_SIZE];
+	int line_start, line_end, scan_pos;
+	bool skip_line;
+	bool input_stalled;
+
+	bool binary;			/* binary framing, selected with the b1/b0 commands */
+	bool skip_lf;			/* the b1 line ended with a CR, its LF may follow */
+	unsigned long cur_reqid;	/* request id of the binary frame being handled */
+
+	/* responses and reports waiting to be written: outbuf[out_start, out_end) */
+	char outbuf[OUTBUF_SIZE];
+	int out_start, out_end;
+
+	DevIOStats iostat;
+
+	int report_inputs, cmd_echo;
+
+	DevQueue *queues;
+	int num_queues;
+	int num_waiting;	/* in all queues */
+	int retention;
+
+	Journal *journal;
+	long wall_offset;	/* wall clock minus monotonic time, usec */
+
+	TraceWriter *trace;
+	MetricsDev *metrics;
+
+	bool setup(int fd);
+	void publish_io_metrics();
+	void compact_input();
+	bool proc_buffered();
+	bool proc_lines();
+	bool proc_frames();
+	void proc_line(const char *line, int len);
+	void send(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	int make_frame(char *frame, int textlen);
+	void runcmd(const char *cmd, int len);
+	int parse_queue(const char *arg, int len);
+	time_t calc_avg_wait(int q) const;
+	void print_wait_stats(int q);
+	void print_percentile(const char *arg, int len);
+	void changed();
+	bool showing_ticket() const;
+
+	void add_ticket(int qidx, long usec);
+	bool serve_customer(int qidx, long usec);
+	void reset_queue(int qidx);
+	void journal_event(int type, int q, int id);
+	void write_snapshot();
+
+public:
+	EvWatch *watch;		/* event loop registration of the device fd */
+
+	/* called whenever the visible state of the device changes */
+	void (*change_func)(Device *dev, void *cls);
+	void *change_cls;
+
+	/* if set, flush hands the queued output to this instead of the device
+	 * fd, and it's considered written.
+	 */
+	void (*output_func)(Device *dev, const char *buf, int len, void *cls);
+	void *output_cls;
+
+	Device();
+	~Device();
+
+	/* number of completed tickets to keep statistics for, per queue */
+	void set_retention(int count);
+	/* number of independent queues (1 to MAX_QUEUES), resets all of them */
+	bool set_num_queues(int count);
+	int get_num_queues() const;
+
+	/* keeps a crash-safe journal of the queue state in the specified file,
+	 * restoring the state it describes, if it already exists.
+	 */
+	bool open_journal(const char *path);
+	void close_journal();
+
+	/* records every byte read from and written to the device, with the time
+	 * it was handled, for replaying with eqreplay.
+	 */
+	bool open_trace(const char *path);
+	void close_trace();
+
+	/* publishes live counters in the specified shared memory slot, see metrics.h */
+	void set_metrics(MetricsDev *m);
+
+	int start(const char *devpath);
+	int start_pty();	/* allocates a new pseudoterminal, see get_path */
+	void stop();
+
+	int get_fd() const;
+	const char *get_path() const;
+
+	/* processes all available input. Responses are only queued; call flush
+	 * to write them out. Stops early (is_input_stalled) when too much output
+	 * has backed up, in which case it should be called again after flushing.
+	 */
+	void proc_input();
+	/* processes len bytes of input from buf instead of the device fd, the
+	 * same way proc_input does. returns the number of bytes consumed, which
+	 * is less than len if it stalled. It can also stall after taking all of
+	 * it, with complete commands still buffered, so keep flushing and calling
+	 * it (with len 0 if need be) while is_input_stalled.
+	 */
+	int feed(const char *buf, int len);
+	bool is_input_stalled() const;
+
+	/* writes as much of the queued output as the device accepts without
+	 * blocking. returns false if some of it is still pending.
+	 */
+	bool flush();
+	bool output_pending() const;
+	bool output_backlogged() const;
+
+	const DevIOStats &get_io_stats() const;
+
+	int get_ticket(int q = 0) const;
+	int get_customer(int q = 0) const;
+
+	void next_customer(int q = 0);
+	void issue_ticket(int q = 0);
+
+	const WaitStats &get_wait_stats(int q = 0) const;
+
+	/* the display and LEDs show the state of queue 0 */
+	int get_display_number() const;
+	int get_led_state(int led) const;
+	/* monotonic time (usec) at which the displayed number and LEDs will change
+	 * by themselves, without any further input, or 0 if they won't.
+	 */
+	uint64_t get_state_expiry() const;
+};
 
 #endif	/* DEV_H_ */
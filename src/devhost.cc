@@ -0,0 +1,240 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include "devhost.h"
+#include "dev.h"
+#include "evloop.h"
+#include "logger.h"
+#include "metrics.h"
+
+static void dev_ready(int fd, unsigned int events, void *cls);
+
+static std::vector<const char*> dev_paths;
+static int num_pty_devs;
+static int retention;
+static int num_queues = 1;
+static const char *journal_path;
+static const char *trace_path;
+static const char *metrics_name;
+
+static std::vector<Device*> devices;
+static EventLoop *evloop;
+
+int devhost_parse_arg(int argc, char **argv, int idx)
+{
+	if(argv[idx][0] != '-') {
+		dev_paths.push_back(argv[idx]);
+		return 1;
+	}
+
+	if(strcmp(argv[idx], "-pty") == 0) {
+		char *endp;
+		if(idx + 1 >= argc || (num_pty_devs = strtol(argv[idx + 1], &endp, 10)) <= 0 || *endp) {
+			fprintf(stderr, "-pty must be followed by the number of devices to create\n");
+			return -1;
+		}
+		return 2;
+	}
+
+	if(strcmp(argv[idx], "-metrics") == 0) {
+		if(idx + 1 >= argc || argv[idx + 1][0] != '/') {
+			fprintf(stderr, "-metrics must be followed by a shared memory name, like /eqemu\n");
+			return -1;
+		}
+		metrics_name = argv[idx + 1];
+		return 2;
+	}
+
+	if(strcmp(argv[idx], "-journal") == 0 || strcmp(argv[idx], "-trace") == 0) {
+		if(idx + 1 >= argc) {
+			fprintf(stderr, "%s must be followed by a file name\n", argv[idx]);
+			return -1;
+		}
+		if(argv[idx][1] == 'j') {
+			journal_path = argv[idx + 1];
+		} else {
+			trace_path = argv[idx + 1];
+		}
+		return 2;
+	}
+
+	if(strcmp(argv[idx], "-retain") == 0) {
+		char *endp;
+		if(idx + 1 >= argc || (retention = strtol(argv[idx + 1], &endp, 10)) <= 0 || *endp) {
+			fprintf(stderr, "-retain must be followed by the number of tickets to keep\n");
+			return -1;
+		}
+		return 2;
+	}
+
+	if(strcmp(argv[idx], "-queues") == 0) {
+		char *endp;
+		if(idx + 1 >= argc || (num_queues = strtol(argv[idx + 1], &endp, 10)) <= 0 ||
+				num_queues > MAX_QUEUES || *endp) {
+			fprintf(stderr, "-queues must be followed by the number of queues per device (1-%d)\n",
+					MAX_QUEUES);
+			return -1;
+		}
+		return 2;
+	}
+	return 0;
+}
+
+void devhost_usage()
+{
+	printf("device options:\n");
+	printf("  <path>        emulate a device on the specified serial port\n");
+	printf("  -pty <count>  allocate <count> pseudoterminals and emulate a device on each\n");
+	printf("  -retain <n>   keep statistics for the last <n> served tickets (default: 1024)\n");
+	printf("  -queues <n>   number of independent queues per device (default: 1)\n");
+	printf("  -journal <f>  keep a crash-safe journal of the queue state in <f>, and\n");
+	printf("                restore the state from it on startup. With multiple\n");
+	printf("                devices, each one uses <f>.<device number>\n");
+	printf("  -trace <f>    record all serial traffic in <f>, for replaying with\n");
+	printf("                eqreplay. Per device like -journal\n");
+	printf("  -metrics <n>  publish live metrics in shared memory segment <n> (e.g.\n");
+	printf("                /eqemu), for monitoring with eqmon\n");
+}
+
+/* per-device file names: with multiple devices, device N uses <path>.N */
+static std::string dev_file_path(const char *path, int idx)
+{
+	std::string res = path;
+	if(devices.size() > 1) {
+		char suffix[16];
+		sprintf(suffix, ".%d", idx);
+		res += suffix;
+	}
+	return res;
+}
+
+bool devhost_init(EventLoop *loop, bool standalone)
+{
+	evloop = loop;
+
+	for(size_t i=0; i<dev_paths.size(); i++) {
+		Device *dev = new Device;
+		if(dev->start(dev_paths[i]) == -1) {
+			delete dev;
+			return false;
+		}
+		devices.push_back(dev);
+	}
+	for(int i=0; i<num_pty_devs; i++) {
+		Device *dev = new Device;
+		if(dev->start_pty() == -1) {
+			delete dev;
+			return false;
+		}
+		printf("device %d: %s\n", (int)devices.size(), dev->get_path());
+		devices.push_back(dev);
+	}
+	fflush(stdout);
+
+	if(devices.empty()) {
+		if(!standalone) {
+			fprintf(stderr, "no devices specified\n");
+			return false;
+		}
+		fprintf(stderr, "no device path specified, running standalone\n");
+		devices.push_back(new Device);
+	}
+
+	if(metrics_name && !metrics_init(metrics_name, devices.size())) {
+		return false;
+	}
+
+	for(size_t i=0; i<devices.size(); i++) {
+		Device *dev = devices[i];
+		dev->set_num_queues(num_queues);
+		if(retention > 0) {
+			dev->set_retention(retention);
+		}
+		if(journal_path && !dev->open_journal(dev_file_path(journal_path, i).c_str())) {
+			return false;
+		}
+		if(trace_path && !dev->open_trace(dev_file_path(trace_path, i).c_str())) {
+			return false;
+		}
+		if(metrics) {
+			dev->set_metrics(metrics_device(i));
+		}
+		if(dev->get_fd() >= 0) {
+			if(!(dev->watch = evloop->add_fd(dev->get_fd(), EV_READ, dev_ready, dev))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void devhost_cleanup()
+{
+	for(size_t i=0; i<devices.size(); i++) {
+		delete devices[i];
+	}
+	devices.clear();
+
+	metrics_cleanup();
+}
+
+int devhost_num_devices()
+{
+	return (int)devices.size();
+}
+
+Device *devhost_device(int idx)
+{
+	return devices[idx];
+}
+
+void devhost_flush(Device *dev)
+{
+	while(dev->flush() && dev->is_input_stalled()) {
+		dev->proc_input();
+	}
+
+	if(dev->watch) {
+		unsigned int ev = dev->output_pending() ? EV_WRITE : 0;
+		if(!dev->is_input_stalled()) {
+			ev |= EV_READ;
+		}
+		evloop->set_events(dev->watch, ev);
+	}
+}
+
+static void dev_ready(int fd, unsigned int events, void *cls)
+{
+	Device *dev = (Device*)cls;
+
+	if(events & EV_READ) {
+		dev->proc_input();
+	}
+	devhost_flush(dev);
+
+	if(events & EV_HUP) {
+		log_warning("device %s hung up", dev->get_path());
+		evloop->remove(dev->watch);
+		dev->watch = 0;
+	}
+}
@@ -0,0 +1,51 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DEVHOST_H_
+#define DEVHOST_H_
+
+class Device;
+class EventLoop;
+
+/* device management shared by the windowed and the headless front-ends */
+
+/* handles device-related command line arguments. returns the number of
+ * arguments consumed, 0 if argv[idx] isn't ours, or -1 on error.
+ */
+int devhost_parse_arg(int argc, char **argv, int idx);
+void devhost_usage();
+
+/* opens all devices requested on the command line and registers them with
+ * the event loop. If none were requested and standalone is true, a single
+ * unconnected device is created instead.
+ */
+bool devhost_init(EventLoop *loop, bool standalone);
+void devhost_cleanup();
+
+/* writes out any queued device output, and keeps the device's event mask in
+ * sync with its output backlog: while output is pending we wait for the fd to
+ * become writable, and while the output queue is backlogged we stop reading
+ * input, so that a slow host gets backpressure instead of lost responses.
+ * Must be called after driving a device from outside its fd callback.
+ */
+void devhost_flush(Device *dev);
+
+int devhost_num_devices();
+Device *devhost_device(int idx);
+
+#endif	/* DEVHOST_H_ */
@@ -0,0 +1,244 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "evloop.h"
+#include "timer.h"
+
+#define MAX_EVENTS	64
+
+struct EvWatch {
+	int fd;
+	unsigned int events;
+	EvFdFunc func;
+	EvTimerFunc timer_func;
+	void *cls;
+	bool dead;
+	EvWatch *next;	/* dead list */
+};
+
+static unsigned int to_epoll(unsigned int ev);
+static unsigned int from_epoll(unsigned int ev);
+
+EventLoop::EventLoop()
+{
+	epfd = -1;
+	quit_pending = false;
+	dead_list = 0;
+	wake_usec = 0;
+}
+
+EventLoop::~EventLoop()
+{
+	destroy();
+}
+
+bool EventLoop::init()
+{
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("failed to create epoll instance");
+		return false;
+	}
+	return true;
+}
+
+void EventLoop::destroy()
+{
+	while(dead_list) {
+		EvWatch *w = dead_list;
+		dead_list = dead_list->next;
+		delete w;
+	}
+	if(epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+}
+
+EvWatch *EventLoop::add_fd(int fd, unsigned int events, EvFdFunc func, void *cls)
+{
+	EvWatch *w = new EvWatch;
+	w->fd = fd;
+	w->events = events;
+	w->func = func;
+	w->timer_func = 0;
+	w->cls = cls;
+	w->dead = false;
+	w->next = 0;
+
+	if(!watch(w, EPOLL_CTL_ADD)) {
+		delete w;
+		return 0;
+	}
+	return w;
+}
+
+bool EventLoop::set_events(EvWatch *w, unsigned int events)
+{
+	if(w->events == events) {
+		return true;
+	}
+	w->events = events;
+	return watch(w, EPOLL_CTL_MOD);
+}
+
+void EventLoop::remove(EvWatch *w)
+{
+	if(!w || w->dead) return;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, 0);
+	if(w->timer_func) {
+		close(w->fd);
+	}
+
+	/* there might still be events for this watch in the batch currently being
+	 * dispatched, so don't free it until the batch is done.
+	 */
+	w->dead = true;
+	w->next = dead_list;
+	dead_list = w;
+}
+
+EvWatch *EventLoop::add_timer(EvTimerFunc func, void *cls)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(fd == -1) {
+		perror("failed to create timer");
+		return 0;
+	}
+
+	EvWatch *w = add_fd(fd, EV_READ, 0, cls);
+	if(!w) {
+		close(fd);
+		return 0;
+	}
+	w->timer_func = func;
+	return w;
+}
+
+bool EventLoop::start_timer(EvWatch *tm, long msec, long interval)
+{
+	struct itimerspec its;
+	its.it_value.tv_sec = msec / 1000;
+	its.it_value.tv_nsec = (msec % 1000) * 1000000;
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+
+	if(timerfd_settime(tm->fd, 0, &its, 0) == -1) {
+		perror("failed to set timer");
+		return false;
+	}
+	return true;
+}
+
+bool EventLoop::stop_timer(EvWatch *tm)
+{
+	return start_timer(tm, 0);
+}
+
+int EventLoop::run_once(long timeout)
+{
+	struct epoll_event ev[MAX_EVENTS];
+	int nev;
+
+	if(wake_usec) {
+		busy_stat.add(get_time_usec() - wake_usec);
+	}
+
+	while((nev = epoll_wait(epfd, ev, MAX_EVENTS, (int)timeout)) == -1) {
+		if(errno != EINTR) {
+			perror("epoll_wait failed");
+			return -1;
+		}
+	}
+	wake_usec = update_now();
+
+	for(int i=0; i<nev; i++) {
+		EvWatch *w = (EvWatch*)ev[i].data.ptr;
+		if(w->dead) continue;
+
+		if(w->timer_func) {
+			uint64_t expirations;
+			if(read(w->fd, &expirations, sizeof expirations) > 0) {
+				w->timer_func(w->cls);
+			}
+		} else {
+			w->func(w->fd, from_epoll(ev[i].events), w->cls);
+		}
+	}
+
+	while(dead_list) {
+		EvWatch *w = dead_list;
+		dead_list = dead_list->next;
+		delete w;
+	}
+	return nev;
+}
+
+void EventLoop::run()
+{
+	quit_pending = false;
+	while(!quit_pending && run_once() != -1);
+}
+
+void EventLoop::quit()
+{
+	quit_pending = true;
+}
+
+const WaitStats &EventLoop::get_busy_stats() const
+{
+	return busy_stat;
+}
+
+bool EventLoop::watch(EvWatch *w, int op)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof ev);
+	ev.events = to_epoll(w->events);
+	ev.data.ptr = w;
+
+	if(epoll_ctl(epfd, op, w->fd, &ev) == -1) {
+		fprintf(stderr, "failed to watch fd %d: %s\n", w->fd, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static unsigned int to_epoll(unsigned int ev)
+{
+	unsigned int res = 0;
+	if(ev & EV_READ) res |= EPOLLIN;
+	if(ev & EV_WRITE) res |= EPOLLOUT;
+	return res;
+}
+
+static unsigned int from_epoll(unsigned int ev)
+{
+	unsigned int res = 0;
+	if(ev & EPOLLIN) res |= EV_READ;
+	if(ev & EPOLLOUT) res |= EV_WRITE;
+	if(ev & (EPOLLHUP | EPOLLERR)) res |= EV_HUP;
+	return res;
+}
@@ -0,0 +1,85 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EVLOOP_H_
+#define EVLOOP_H_
+
+#include <inttypes.h>
+#include "waitstat.h"
+
+enum {
+	EV_READ		= 1,
+	EV_WRITE	= 2,
+	EV_HUP		= 4		/* reported only, hangup or error condition */
+};
+
+typedef void (*EvFdFunc)(int fd, unsigned int events, void *cls);
+typedef void (*EvTimerFunc)(void *cls);
+
+struct EvWatch;
+
+/* epoll based reactor. File descriptors are registered with a callback, which
+ * is invoked with the ready events; timers are backed by timerfds registered
+ * in the same epoll set, so any number of them costs nothing while idle.
+ */
+class EventLoop {
+private:
+	int epfd;
+	bool quit_pending;
+	EvWatch *dead_list;
+
+	uint64_t wake_usec;
+	WaitStats busy_stat;
+
+	bool watch(EvWatch *w, int op);
+	void release(EvWatch *w);
+
+public:
+	EventLoop();
+	~EventLoop();
+
+	bool init();
+	void destroy();
+
+	EvWatch *add_fd(int fd, unsigned int events, EvFdFunc func, void *cls = 0);
+	bool set_events(EvWatch *w, unsigned int events);
+	void remove(EvWatch *w);
+
+	EvWatch *add_timer(EvTimerFunc func, void *cls = 0);
+	/* arms a timer to fire after msec milliseconds, and then every interval
+	 * milliseconds if interval is non-zero. msec 0 disarms the timer.
+	 */
+	bool start_timer(EvWatch *tm, long msec, long interval = 0);
+	bool stop_timer(EvWatch *tm);
+
+	/* waits for at most timeout milliseconds (-1: forever) and dispatches
+	 * everything that became ready. returns the number of events handled or
+	 * -1 on failure.
+	 */
+	int run_once(long timeout = -1);
+	void run();
+	void quit();
+
+	/* time (usec) from every wakeup to the next wait, spent handling events
+	 * and doing whatever the caller does between run_once calls. Input which
+	 * arrives while the loop is busy waits at most this long to be noticed.
+	 */
+	const WaitStats &get_busy_stats() const;
+};
+
+#endif	/* EVLOOP_H_ */
@@ -19,6 +19,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <alloca.h>
 #include "fblur.h"
+#include "threadpool.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define FBLUR_X86
+#include <immintrin.h>
+#endif
 
 #if  defined(__i386__) || defined(__ia64__) || defined(WIN32) || \
     (defined(__alpha__) || defined(__alpha)) || \
@@ -53,86 +59,569 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
 #define MAX(a, b)	((a) > (b) ? (a) : (b))
+#define ALIGN_UP(n, a)	(((n) + (a) - 1) / (a) * (a))
+
+
+/* The SIMD kernels keep the window sums of each color channel in 16-bit
+ * lanes, so they handle blur sizes up to 257, and blur several lines at once:
+ * 2 with SSE2, 4 with AVX2. Instead of dividing, they multiply by a 16-bit
+ * reciprocal of each possible divisor and shift. The reciprocals are verified
+ * to give exactly the same result as the integer division for every possible
+ * sum, so the output is bit-identical to the scalar code.
+ */
+#define MAX_SIMD_AMOUNT		257
+
+/* The vertical pass streams down the image a row at a time, over tiles of up
+ * to this many columns, keeping the window sums of every column in the tile.
+ * The output overwrites the rows it has passed, so the last half + 1
+ * original rows of the tile are kept in a ring buffer, for subtracting them
+ * from the sums once they leave the window. Every access is a contiguous run
+ * of pixels along a row, instead of a cache miss per pixel down each column,
+ * and the sums and the ring stay in the L1 cache.
+ */
+#define VERT_TILE		256
+
+/* With a thread pool, images of at least this many pixels are split into
+ * bands of rows for the horizontal pass and of columns for the vertical one,
+ * a few per thread so that a thread held up by something else doesn't hold up
+ * the whole pass. Every band is blurred exactly like the rest of the image
+ * would be, so the result doesn't depend on the number of threads.
+ */
+#define MIN_THREADED_PIXELS	32768
+#define BANDS_PER_THREAD	4
+#define ROW_BAND_ALIGN		4	/* whole groups of rows for the SIMD kernels */
+#define COL_BAND_ALIGN		16	/* whole cache lines */
 
+struct RecipTable {
+	int amount;		/* blur size the table is for, 0 if none */
+	bool exact;		/* whether every divisor has an exact reciprocal */
+	uint16_t mul[MAX_SIMD_AMOUNT + 1];
+	uint16_t shift[MAX_SIMD_AMOUNT + 1];
+};
+
+struct BlurBands {
+	int isa, half;
+	uint32_t *buf;
+	int x, y;
+	int band;		/* rows or columns per band */
+};
+
+static void blur_threaded(int dir, int amount, uint32_t *buf, int x, int y);
+static void blur_rows_band(int idx, void *cls);
+static void blur_cols_band(int idx, void *cls);
+static void blur_rows(int isa, int half, uint32_t *buf, int x, int y);
+static void blur_cols(int isa, int half, uint32_t *buf, int x, int y, int stride);
+static void blur_line(const uint32_t *sptr, uint32_t *dptr, int len, int half, int pstride);
+static void blur_cols_scalar(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums);
+static int get_isa(int amount, int len);
+#ifdef FBLUR_X86
+static bool find_recip(int d, uint16_t *mul, uint16_t *shift);
+static void gather_rows(uint32_t *tmp, const uint32_t *src, int n, int x);
+static void blur_rows_sse2(const uint32_t *tmp, uint32_t *dst, int x, int half);
+static void blur_rows_avx2(const uint32_t *tmp, uint32_t *dst, int x, int half);
+static void blur_cols_sse2(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums);
+static void blur_cols_avx2(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums);
+#endif
+
+static int max_isa = FBLUR_ISA_AVX2;
+static ThreadPool *pool;
+#ifdef FBLUR_X86
+static RecipTable recip;
+#endif
+
+/* pixels per vector of each instruction set */
+static const int isa_pixels[] = { 1, 2, 4 };
 
 void fast_blur(int dir, int amount, uint32_t *buf, int x, int y)
 {
-	int i, j, half;
-	uint32_t *dptr, *sptr, *tmp_buf;
+	if(amount <= 1) return;
 
-	int blur_len = dir == BLUR_HORIZ ? x : y;
-	int blur_times = dir == BLUR_HORIZ ? y : x;
+	int half = amount / 2;
 
-	if(amount <= 1) return;
+	if(pool && pool->get_num_threads() > 1 && x * y >= MIN_THREADED_PIXELS) {
+		blur_threaded(dir, amount, buf, x, y);
+	} else if(dir == BLUR_HORIZ) {
+		blur_rows(get_isa(amount, x), half, buf, x, y);
+	} else {
+		blur_cols(get_isa(amount, y), half, buf, x, y, x);
+	}
 
-	dptr = buf;
-	half = amount / 2;
+	if(dir == BLUR_BOTH) {
+		fast_blur(BLUR_HORIZ, amount, buf, x, y);
+	}
+}
 
-	tmp_buf = (uint32_t*)alloca(blur_len * sizeof(uint32_t));
+int fast_blur_use_isa(int isa)
+{
+	max_isa = isa;
+	return get_isa(3, 3);
+}
 
-	for(i=0; i<blur_times; i++) {
-		int ar = 0, ag = 0, ab = 0;
-		int divisor = 0;
+void fast_blur_use_pool(ThreadPool *tpool)
+{
+	pool = tpool;
+}
 
-		if(dir == BLUR_HORIZ) {
-			sptr = tmp_buf;
-			memcpy(sptr, dptr, x * sizeof(uint32_t));
-		} else {
-			dptr = buf + i;
+static void blur_threaded(int dir, int amount, uint32_t *buf, int x, int y)
+{
+	BlurBands bands;
+	bands.half = amount / 2;
+	bands.buf = buf;
+	bands.x = x;
+	bands.y = y;
+
+	/* get_isa also prepares the reciprocals, which the bands only read */
+	int nbands = pool->get_num_threads() * BANDS_PER_THREAD;
+
+	if(dir == BLUR_HORIZ) {
+		bands.isa = get_isa(amount, x);
+		bands.band = ALIGN_UP((y + nbands - 1) / nbands, ROW_BAND_ALIGN);
+		pool->run((y + bands.band - 1) / bands.band, blur_rows_band, &bands);
+	} else {
+		bands.isa = get_isa(amount, y);
+		bands.band = ALIGN_UP((x + nbands - 1) / nbands, COL_BAND_ALIGN);
+		pool->run((x + bands.band - 1) / bands.band, blur_cols_band, &bands);
+	}
+}
+
+static void blur_rows_band(int idx, void *cls)
+{
+	BlurBands *bands = (BlurBands*)cls;
+	int start = idx * bands->band;
+	int count = MIN(bands->band, bands->y - start);
+
+	blur_rows(bands->isa, bands->half, bands->buf + start * bands->x, bands->x, count);
+}
+
+static void blur_cols_band(int idx, void *cls)
+{
+	BlurBands *bands = (BlurBands*)cls;
+	int start = idx * bands->band;
+	int count = MIN(bands->band, bands->x - start);
+
+	blur_cols(bands->isa, bands->half, bands->buf + start, count, bands->y, bands->x);
+}
+
+static void blur_rows(int isa, int half, uint32_t *buf, int x, int y)
+{
+	int i = 0;
+	int nlines = isa_pixels[isa];
+	uint32_t *tmp_buf = (uint32_t*)alloca(x * nlines * sizeof(uint32_t));
+
+#ifdef FBLUR_X86
+	if(nlines > 1) {
+		for(; i + nlines <= y; i += nlines) {
+			uint32_t *lptr = buf + i * x;
+
+			gather_rows(tmp_buf, lptr, nlines, x);
+			if(isa == FBLUR_ISA_AVX2) {
+				blur_rows_avx2(tmp_buf, lptr, x, half);
+			} else {
+				blur_rows_sse2(tmp_buf, lptr, x, half);
+			}
+		}
+	}
+#endif
+
+	/* the rest one row at a time */
+	for(; i<y; i++) {
+		uint32_t *dptr = buf + i * x;
 
-			sptr = tmp_buf;
-			for(j=0; j<y; j++) {
-				*sptr++ = *dptr;
-				dptr += x;
+		memcpy(tmp_buf, dptr, x * sizeof(uint32_t));
+		blur_line(tmp_buf, dptr, x, half, 1);
+	}
+}
+
+/* blurs x columns of an image with rows of stride pixels */
+static void blur_cols(int isa, int half, uint32_t *buf, int x, int y, int stride)
+{
+	if(y <= half) {
+		/* the window never fills, leave it to the column at a time code */
+		uint32_t *tmp_buf = (uint32_t*)alloca(y * sizeof(uint32_t));
+
+		for(int i=0; i<x; i++) {
+			for(int j=0; j<y; j++) {
+				tmp_buf[j] = buf[j * stride + i];
 			}
-			dptr = buf + i;
-			sptr = tmp_buf;
+			blur_line(tmp_buf, buf + i, y, half, stride);
 		}
+		return;
+	}
 
+	int sums[VERT_TILE * 3];
+	uint32_t *ring = (uint32_t*)alloca((half + 1) * MIN(x, VERT_TILE) * sizeof(uint32_t));
 
-		for(j=0; j<half; j++) {
-			uint32_t pixel = tmp_buf[j];
-			ar += RED(pixel);
-			ag += GREEN(pixel);
-			ab += BLUE(pixel);
-			divisor++;
+	for(int i=0; i<x; i+=VERT_TILE) {
+		int ncols = MIN(VERT_TILE, x - i);
+
+		/* as many columns as fill whole vectors with SIMD, the rest scalar */
+		int nvec = ncols - ncols % isa_pixels[isa];
+		if(isa == FBLUR_ISA_SCALAR) {
+			nvec = 0;
+		}
+#ifdef FBLUR_X86
+		if(nvec > 0 && isa == FBLUR_ISA_AVX2) {
+			blur_cols_avx2(buf + i, stride, y, half, nvec, ring, sums);
+		} else if(nvec > 0 && isa == FBLUR_ISA_SSE2) {
+			blur_cols_sse2(buf + i, stride, y, half, nvec, ring, sums);
+		}
+#endif
+		if(nvec < ncols) {
+			blur_cols_scalar(buf + i + nvec, stride, y, half, ncols - nvec, ring, sums);
 		}
+	}
+}
+
+/* number of pixels in the window around j, and so the divisor */
+#define WINDOW(j, len, half)	(MIN((j) + (half), (len) - 1) - MAX((j) - (half), 0) + 1)
+
+/* The column kernels blur ncols columns starting at buf, down the y rows of
+ * the image, x pixels apart. ring needs room for half + 1 rows of ncols
+ * pixels, and sums for 3 ints per column.
+ */
+static void blur_cols_scalar(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums)
+{
+	memset(sums, 0, ncols * 3 * sizeof *sums);
 
-		for(j=0; j<blur_len; j++) {
+	for(int j=0; j<half; j++) {
+		const uint32_t *row = buf + j * x;
+		for(int k=0; k<ncols; k++) {
+			sums[k * 3] += RED(row[k]);
+			sums[k * 3 + 1] += GREEN(row[k]);
+			sums[k * 3 + 2] += BLUE(row[k]);
+		}
+	}
+
+	for(int j=0; j<y; j++) {
+		uint32_t *row = buf + j * x;
+		/* the ring slot of row j held row j - half - 1 */
+		uint32_t *slot = ring + (j % (half + 1)) * ncols;
+		const uint32_t *out = j > half ? slot : 0;
+		const uint32_t *in = j < y - half ? buf + (j + half) * x : 0;
+		int divisor = WINDOW(j, y, half);
+
+		for(int k=0; k<ncols; k++) {
+			int *s = sums + k * 3;
 			int r, g, b;
 
-			if(j > half) {
-				uint32_t out = *(sptr - half - 1);
-				ar -= RED(out);
-				ag -= GREEN(out);
-				ab -= BLUE(out);
-				divisor--;
+			if(out) {
+				s[0] -= RED(out[k]);
+				s[1] -= GREEN(out[k]);
+				s[2] -= BLUE(out[k]);
 			}
-
-			if(j < blur_len - half) {
-				uint32_t in = *(sptr + half);
-				ar += RED(in);
-				ag += GREEN(in);
-				ab += BLUE(in);
-				divisor++;
+			if(in) {
+				s[0] += RED(in[k]);
+				s[1] += GREEN(in[k]);
+				s[2] += BLUE(in[k]);
 			}
+			slot[k] = row[k];
 
-			r = ar / divisor;
-			g = ag / divisor;
-			b = ab / divisor;
+			r = s[0] / divisor;
+			g = s[1] / divisor;
+			b = s[2] / divisor;
 
 			r = MAX(MIN(r, 255), 0);
 			g = MAX(MIN(g, 255), 0);
 			b = MAX(MIN(b, 255), 0);
 
-			*dptr = RGB(r, g, b);
-			dptr += dir == BLUR_HORIZ ? 1 : x;
-			sptr++;
+			row[k] = RGB(r, g, b);
 		}
+	}
+}
 
+/* blurs the line of len pixels in sptr, writing the result every pstride
+ * pixels starting at dptr
+ */
+static void blur_line(const uint32_t *sptr, uint32_t *dptr, int len, int half, int pstride)
+{
+	int j;
+	int ar = 0, ag = 0, ab = 0;
+	int divisor = 0;
+
+	/* the window can be wider than the whole line */
+	for(j=0; j<MIN(half, len); j++) {
+		uint32_t pixel = sptr[j];
+		ar += RED(pixel);
+		ag += GREEN(pixel);
+		ab += BLUE(pixel);
+		divisor++;
 	}
 
-	if(dir == BLUR_BOTH) {
-		fast_blur(BLUR_HORIZ, amount, buf, x, y);
+	for(j=0; j<len; j++) {
+		int r, g, b;
+
+		if(j > half) {
+			uint32_t out = *(sptr - half - 1);
+			ar -= RED(out);
+			ag -= GREEN(out);
+			ab -= BLUE(out);
+			divisor--;
+		}
+
+		if(j < len - half) {
+			uint32_t in = *(sptr + half);
+			ar += RED(in);
+			ag += GREEN(in);
+			ab += BLUE(in);
+			divisor++;
+		}
+
+		r = ar / divisor;
+		g = ag / divisor;
+		b = ab / divisor;
+
+		r = MAX(MIN(r, 255), 0);
+		g = MAX(MIN(g, 255), 0);
+		b = MAX(MIN(b, 255), 0);
+
+		*dptr = RGB(r, g, b);
+		dptr += pstride;
+		sptr++;
+	}
+}
+
+/* picks the best instruction set which can blur lines of len pixels by amount */
+static int get_isa(int amount, int len)
+{
+#ifdef FBLUR_X86
+	static int cpu_isa = -1;
+
+	if(cpu_isa == -1) {
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			cpu_isa = FBLUR_ISA_AVX2;
+		} else if(__builtin_cpu_supports("sse2")) {
+			cpu_isa = FBLUR_ISA_SSE2;
+		} else {
+			cpu_isa = FBLUR_ISA_SCALAR;
+		}
+	}
+
+	/* shorter lines than the window would need divisors of 1 */
+	if(amount > MAX_SIMD_AMOUNT || len <= amount / 2 || len < 2) {
+		return FBLUR_ISA_SCALAR;
+	}
+
+	if(recip.amount != amount) {
+		recip.amount = amount;
+		recip.exact = true;
+		for(int d=2; d<=amount / 2 * 2 + 1; d++) {
+			if(!find_recip(d, recip.mul + d, recip.shift + d)) {
+				recip.exact = false;
+				break;
+			}
+		}
+	}
+	if(!recip.exact) {
+		return FBLUR_ISA_SCALAR;
+	}
+	return MIN(cpu_isa, max_isa);
+#else
+	return FBLUR_ISA_SCALAR;
+#endif
+}
+
+#ifdef FBLUR_X86
+/* finds mul and shift, such that (s * mul) >> (16 + shift) == s / d for all
+ * window sums s of 8-bit values
+ */
+static bool find_recip(int d, uint16_t *mul, uint16_t *shift)
+{
+	for(int k=0; k<16; k++) {
+		uint32_t m = ((1u << (16 + k)) + d - 1) / d;
+		if(m > 0xffff) break;
+
+		int s;
+		for(s=0; s<=255 * d; s++) {
+			if(((s * m) >> (16 + k)) != (uint32_t)(s / d)) break;
+		}
+		if(s > 255 * d) {
+			*mul = m;
+			*shift = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* interleaves n rows into tmp: pixel j of every row, then pixel j + 1 ... */
+static void gather_rows(uint32_t *tmp, const uint32_t *src, int n, int x)
+{
+	for(int k=0; k<n; k++) {
+		for(int j=0; j<x; j++) {
+			tmp[j * n + k] = src[j];
+		}
+		src += x;
+	}
+}
+
+/* RGB() leaves the alpha byte 0 */
+#define RGB_MASK	0x00ffffff
+
+/* The row kernels blur as many rows as they have pixels per vector, starting
+ * at dst, from the interleaved copy of them in tmp.
+ */
+__attribute__((target("sse2")))
+static void blur_rows_sse2(const uint32_t *tmp, uint32_t *dst, int x, int half)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i mask = _mm_set1_epi32(RGB_MASK);
+	__m128i sum = zero;
+
+	for(int j=0; j<half; j++) {
+		__m128i in = _mm_loadl_epi64((const __m128i*)(tmp + j * 2));
+		sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(in, zero));
+	}
+
+	for(int j=0; j<x; j++) {
+		if(j > half) {
+			__m128i out = _mm_loadl_epi64((const __m128i*)(tmp + (j - half - 1) * 2));
+			sum = _mm_sub_epi16(sum, _mm_unpacklo_epi8(out, zero));
+		}
+		if(j < x - half) {
+			__m128i in = _mm_loadl_epi64((const __m128i*)(tmp + (j + half) * 2));
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(in, zero));
+		}
+
+		int d = WINDOW(j, x, half);
+		__m128i avg = _mm_mulhi_epu16(sum, _mm_set1_epi16(recip.mul[d]));
+		avg = _mm_srl_epi16(avg, _mm_cvtsi32_si128(recip.shift[d]));
+		avg = _mm_and_si128(_mm_packus_epi16(avg, avg), mask);
+
+		dst[j] = _mm_cvtsi128_si32(avg);
+		dst[j + x] = _mm_cvtsi128_si32(_mm_srli_si128(avg, 4));
+	}
+}
+
+__attribute__((target("avx2")))
+static void blur_rows_avx2(const uint32_t *tmp, uint32_t *dst, int x, int half)
+{
+	__m128i mask = _mm_set1_epi32(RGB_MASK);
+	__m256i sum = _mm256_setzero_si256();
+
+	for(int j=0; j<half; j++) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(tmp + j * 4));
+		sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(in));
+	}
+
+	for(int j=0; j<x; j++) {
+		if(j > half) {
+			__m128i out = _mm_loadu_si128((const __m128i*)(tmp + (j - half - 1) * 4));
+			sum = _mm256_sub_epi16(sum, _mm256_cvtepu8_epi16(out));
+		}
+		if(j < x - half) {
+			__m128i in = _mm_loadu_si128((const __m128i*)(tmp + (j + half) * 4));
+			sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(in));
+		}
+
+		int d = WINDOW(j, x, half);
+		__m256i avg = _mm256_mulhi_epu16(sum, _mm256_set1_epi16(recip.mul[d]));
+		avg = _mm256_srl_epi16(avg, _mm_cvtsi32_si128(recip.shift[d]));
+		__m128i res = _mm_packus_epi16(_mm256_castsi256_si128(avg), _mm256_extracti128_si256(avg, 1));
+		res = _mm_and_si128(res, mask);
+
+		dst[j] = _mm_cvtsi128_si32(res);
+		dst[j + x] = _mm_extract_epi32(res, 1);
+		dst[j + x * 2] = _mm_extract_epi32(res, 2);
+		dst[j + x * 3] = _mm_extract_epi32(res, 3);
+	}
+}
+__attribute__((target("sse2")))
+static void blur_cols_sse2(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i mask = _mm_set1_epi32(RGB_MASK);
+	__m128i *vsum = (__m128i*)sums;		/* 2 pixels of 16-bit sums per vector */
+
+	for(int k=0; k<ncols; k+=2) {
+		_mm_storeu_si128(vsum + k / 2, zero);
+	}
+	for(int j=0; j<half; j++) {
+		const uint32_t *row = buf + j * x;
+		for(int k=0; k<ncols; k+=2) {
+			__m128i px = _mm_loadl_epi64((const __m128i*)(row + k));
+			__m128i sum = _mm_loadu_si128(vsum + k / 2);
+			_mm_storeu_si128(vsum + k / 2, _mm_add_epi16(sum, _mm_unpacklo_epi8(px, zero)));
+		}
+	}
+
+	for(int j=0; j<y; j++) {
+		uint32_t *row = buf + j * x;
+		uint32_t *slot = ring + (j % (half + 1)) * ncols;
+		const uint32_t *out = j > half ? slot : 0;
+		const uint32_t *in = j < y - half ? buf + (j + half) * x : 0;
+
+		int d = WINDOW(j, y, half);
+		__m128i mul = _mm_set1_epi16(recip.mul[d]);
+		__m128i shift = _mm_cvtsi32_si128(recip.shift[d]);
+
+		for(int k=0; k<ncols; k+=2) {
+			__m128i sum = _mm_loadu_si128(vsum + k / 2);
+			if(out) {
+				__m128i px = _mm_loadl_epi64((const __m128i*)(out + k));
+				sum = _mm_sub_epi16(sum, _mm_unpacklo_epi8(px, zero));
+			}
+			if(in) {
+				__m128i px = _mm_loadl_epi64((const __m128i*)(in + k));
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(px, zero));
+			}
+			_mm_storeu_si128(vsum + k / 2, sum);
+
+			_mm_storel_epi64((__m128i*)(slot + k), _mm_loadl_epi64((const __m128i*)(row + k)));
+
+			__m128i avg = _mm_srl_epi16(_mm_mulhi_epu16(sum, mul), shift);
+			avg = _mm_and_si128(_mm_packus_epi16(avg, avg), mask);
+			_mm_storel_epi64((__m128i*)(row + k), avg);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void blur_cols_avx2(uint32_t *buf, int x, int y, int half, int ncols, uint32_t *ring, int *sums)
+{
+	__m128i mask = _mm_set1_epi32(RGB_MASK);
+	__m256i *vsum = (__m256i*)sums;		/* 4 pixels of 16-bit sums per vector */
+
+	for(int k=0; k<ncols; k+=4) {
+		_mm256_storeu_si256(vsum + k / 4, _mm256_setzero_si256());
+	}
+	for(int j=0; j<half; j++) {
+		const uint32_t *row = buf + j * x;
+		for(int k=0; k<ncols; k+=4) {
+			__m128i px = _mm_loadu_si128((const __m128i*)(row + k));
+			__m256i sum = _mm256_loadu_si256(vsum + k / 4);
+			_mm256_storeu_si256(vsum + k / 4, _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(px)));
+		}
+	}
+
+	for(int j=0; j<y; j++) {
+		uint32_t *row = buf + j * x;
+		uint32_t *slot = ring + (j % (half + 1)) * ncols;
+		const uint32_t *out = j > half ? slot : 0;
+		const uint32_t *in = j < y - half ? buf + (j + half) * x : 0;
+
+		int d = WINDOW(j, y, half);
+		__m256i mul = _mm256_set1_epi16(recip.mul[d]);
+		__m128i shift = _mm_cvtsi32_si128(recip.shift[d]);
+
+		for(int k=0; k<ncols; k+=4) {
+			__m256i sum = _mm256_loadu_si256(vsum + k / 4);
+			if(out) {
+				__m128i px = _mm_loadu_si128((const __m128i*)(out + k));
+				sum = _mm256_sub_epi16(sum, _mm256_cvtepu8_epi16(px));
+			}
+			if(in) {
+				__m128i px = _mm_loadu_si128((const __m128i*)(in + k));
+				sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(px));
+			}
+			_mm256_storeu_si256(vsum + k / 4, sum);
+
+			_mm_storeu_si128((__m128i*)(slot + k), _mm_loadu_si128((const __m128i*)(row + k)));
+
+			__m256i avg = _mm256_srl_epi16(_mm256_mulhi_epu16(sum, mul), shift);
+			__m128i res = _mm_packus_epi16(_mm256_castsi256_si128(avg), _mm256_extracti128_si256(avg, 1));
+			_mm_storeu_si128((__m128i*)(row + k), _mm_and_si128(res, mask));
+		}
 	}
 }
+#endif	/* FBLUR_X86 */
@@ -21,12 +21,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <inttypes.h>
 
+class ThreadPool;
+
 enum {
 	BLUR_BOTH,	/* blur in X and Y */
 	BLUR_HORIZ,	/* blur in X */
 	BLUR_VERT	/* blur in Y */
 };
 
+/* instruction sets of the blur kernels, in order of preference */
+enum {
+	FBLUR_ISA_SCALAR,
+	FBLUR_ISA_SSE2,
+	FBLUR_ISA_AVX2
+};
+
+/* box blur with a window of amount pixels. The alpha channel is cleared. */
 void fast_blur(int dir, int amount, uint32_t *buf, int x, int y);
 
+/* the best instruction set supported by the CPU is used automatically. This
+ * limits it to isa, for testing and benchmarking, and returns the one which
+ * will actually be used.
+ */
+int fast_blur_use_isa(int isa);
+
+/* splits large blurs into bands of rows or columns, run on the threads of
+ * pool. The result is the same with any number of threads. Null to blur on
+ * the calling thread only, which is the default.
+ */
+void fast_blur_use_pool(ThreadPool *pool);
+
 #endif	/* FBLUR_H_ */
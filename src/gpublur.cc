@@ -0,0 +1,262 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <GL/glew.h>
+#include "gpublur.h"
+#include "logger.h"
+
+/* The fragment shader averages the window of texels around each pixel which
+ * fall inside the image, just like fast_blur, and divides the same way its
+ * integer division does, so both paths produce the same glow. Every texel is
+ * rounded back to the 8-bit integer it stands for before it's summed, and the
+ * float quotient is corrected by one if it landed on the wrong side of an
+ * integer. All the values involved are integers well below 2^24, which floats
+ * represent exactly, so this holds for any window size, without relying on the
+ * precision of the division. The window radius is compiled in.
+ */
+static const char *vsdr_src =
+	"void main()\n"
+	"{\n"
+	"	gl_Position = gl_Vertex;\n"
+	"}\n";
+
+static const char *psdr_fmt =
+	"#define RADIUS %d\n"
+	"uniform sampler2D tex;\n"
+	"uniform vec2 dir;\n"
+	"uniform vec2 size;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 uv = gl_FragCoord.xy / size;\n"
+	"	vec2 delta = dir / size;\n"
+	"	float pos = dot(floor(gl_FragCoord.xy), dir);\n"
+	"	float last = dot(size, dir) - 1.0;\n"
+	"\n"
+	"	/* texels outside the image are clamped to the edge, and masked out */\n"
+	"	vec3 sum = vec3(0.0, 0.0, 0.0);\n"
+	"	for(int i=-RADIUS; i<=RADIUS; i++) {\n"
+	"		float p = pos + float(i);\n"
+	"		float inside = step(0.0, p) * step(p, last);\n"
+	"		sum += floor(texture2D(tex, uv + delta * float(i)).rgb * 255.0 + 0.5) * inside;\n"
+	"	}\n"
+	"	float count = min(pos + float(RADIUS), last) - max(pos - float(RADIUS), 0.0) + 1.0;\n"
+	"\n"
+	"	/* integer division of the 8-bit sums */\n"
+	"	vec3 avg = floor((sum + 0.5) / count);\n"
+	"	avg -= step(sum + 0.5, avg * count);\n"
+	"	avg += step(avg * count + count, sum + 0.5);\n"
+	"	gl_FragColor = vec4(avg / 255.0, 0.0);\n"
+	"}\n";
+
+static unsigned int create_shader(unsigned int type, const char *src);
+
+GpuBlur::GpuBlur()
+{
+	fbo[0] = fbo[1] = tex[0] = tex[1] = 0;
+	depth_rb = 0;
+	prog = vsdr = psdr = 0;
+	uloc_dir = uloc_size = -1;
+	xsz = ysz = 0;
+}
+
+GpuBlur::~GpuBlur()
+{
+	destroy();
+}
+
+bool GpuBlur::is_supported()
+{
+	return GLEW_VERSION_2_0 && GLEW_ARB_framebuffer_object;
+}
+
+bool GpuBlur::init(int amount)
+{
+	char src[1024];
+	snprintf(src, sizeof src, psdr_fmt, amount > 1 ? amount / 2 : 0);
+
+	if(!(vsdr = create_shader(GL_VERTEX_SHADER, vsdr_src)) ||
+			!(psdr = create_shader(GL_FRAGMENT_SHADER, src))) {
+		destroy();
+		return false;
+	}
+
+	prog = glCreateProgram();
+	glAttachShader(prog, vsdr);
+	glAttachShader(prog, psdr);
+	glLinkProgram(prog);
+
+	int status;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if(!status) {
+		char buf[512];
+		glGetProgramInfoLog(prog, sizeof buf, 0, buf);
+		log_error("failed to link the blur shader program: %s", buf);
+		destroy();
+		return false;
+	}
+
+	glUseProgram(prog);
+	glUniform1i(glGetUniformLocation(prog, "tex"), 0);
+	uloc_dir = glGetUniformLocation(prog, "dir");
+	uloc_size = glGetUniformLocation(prog, "size");
+	glUseProgram(0);
+
+	glGenFramebuffers(2, fbo);
+	glGenTextures(2, tex);
+	glGenRenderbuffers(1, &depth_rb);
+	return true;
+}
+
+void GpuBlur::destroy()
+{
+	if(prog) {
+		glDeleteProgram(prog);
+		prog = 0;
+	}
+	if(vsdr) {
+		glDeleteShader(vsdr);
+		vsdr = 0;
+	}
+	if(psdr) {
+		glDeleteShader(psdr);
+		psdr = 0;
+	}
+	if(fbo[0]) {
+		glDeleteFramebuffers(2, fbo);
+		glDeleteTextures(2, tex);
+		glDeleteRenderbuffers(1, &depth_rb);
+		fbo[0] = fbo[1] = tex[0] = tex[1] = 0;
+		depth_rb = 0;
+	}
+}
+
+bool GpuBlur::resize(int xsz, int ysz)
+{
+	if(xsz < 1) xsz = 1;
+	if(ysz < 1) ysz = 1;
+
+	this->xsz = xsz;
+	this->ysz = ysz;
+
+	for(int i=0; i<2; i++) {
+		glBindTexture(GL_TEXTURE_2D, tex[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, xsz, ysz, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex[i], 0);
+	}
+
+	/* only the first one is rendered into with depth testing */
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, xsz, ysz);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+
+	bool complete = true;
+	for(int i=0; i<2; i++) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo[i]);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			log_error("incomplete %dx%d glow framebuffer", xsz, ysz);
+			complete = false;
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+void GpuBlur::begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[0]);
+	glViewport(0, 0, xsz, ysz);
+}
+
+void GpuBlur::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GpuBlur::blur()
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_BLEND);
+	glViewport(0, 0, xsz, ysz);
+
+	glUseProgram(prog);
+	glUniform2f(uloc_size, xsz, ysz);
+
+	/* same order as fast_blur: vertical first, back to the first texture */
+	blur_pass(0, 0, 1);
+	blur_pass(1, 1, 0);
+
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glPopAttrib();
+
+	/* the result is stretched over the window */
+	glBindTexture(GL_TEXTURE_2D, tex[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+/* renders a pass from tex[src] into the other texture */
+void GpuBlur::blur_pass(int src, int dir_x, int dir_y)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[!src]);
+	glBindTexture(GL_TEXTURE_2D, tex[src]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glUniform2f(uloc_dir, dir_x, dir_y);
+
+	glBegin(GL_QUADS);
+	glVertex2f(-1, -1);
+	glVertex2f(1, -1);
+	glVertex2f(1, 1);
+	glVertex2f(-1, 1);
+	glEnd();
+}
+
+unsigned int GpuBlur::get_texture() const
+{
+	return tex[0];
+}
+
+static unsigned int create_shader(unsigned int type, const char *src)
+{
+	unsigned int sdr = glCreateShader(type);
+	glShaderSource(sdr, 1, &src, 0);
+	glCompileShader(sdr);
+
+	int status;
+	glGetShaderiv(sdr, GL_COMPILE_STATUS, &status);
+	if(!status) {
+		char buf[512];
+		glGetShaderInfoLog(sdr, sizeof buf, 0, buf);
+		log_error("failed to compile the %s blur shader: %s",
+				type == GL_VERTEX_SHADER ? "vertex" : "pixel", buf);
+		glDeleteShader(sdr);
+		return 0;
+	}
+	return sdr;
+}
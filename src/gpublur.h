@@ -0,0 +1,60 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef GPUBLUR_H_
+#define GPUBLUR_H_
+
+/* Box blur on the GPU, equivalent to fast_blur(BLUR_BOTH, ...) on the CPU,
+ * but without ever leaving video memory. The image to blur is rendered
+ * straight into an offscreen framebuffer (between begin and end), and each
+ * call to blur does a vertical and a horizontal shader pass, ping-ponging
+ * between two textures. The result is left in get_texture().
+ */
+class GpuBlur {
+private:
+	unsigned int fbo[2], tex[2];
+	unsigned int depth_rb;
+	unsigned int prog, vsdr, psdr;
+	int uloc_dir, uloc_size;
+	int xsz, ysz;
+
+	void blur_pass(int src, int dir_x, int dir_y);
+
+public:
+	GpuBlur();
+	~GpuBlur();
+
+	/* checks for framebuffer object and GLSL support */
+	static bool is_supported();
+
+	/* amount is the blur window size, as passed to fast_blur */
+	bool init(int amount);
+	void destroy();
+
+	bool resize(int xsz, int ysz);
+
+	/* redirects rendering to the offscreen image, and back */
+	void begin();
+	void end();
+
+	void blur();
+
+	unsigned int get_texture() const;
+};
+
+#endif	/* GPUBLUR_H_ */
@@ -0,0 +1,141 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* protocol-only front-end: runs the device state machines and their serial
+ * I/O without any of the X11/OpenGL machinery, for CI and soak testing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include "devhost.h"
+#include "logger.h"
+#include "evloop.h"
+
+static void sig_ready(int fd, unsigned int events, void *cls);
+static int proc_args(int argc, char **argv);
+
+static EventLoop evloop;
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	if(!evloop.init()) {
+		return 1;
+	}
+	log_start();
+
+	/* handle termination signals synchronously from the event loop, so that
+	 * everything gets a chance to shut down cleanly.
+	 */
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGHUP);
+	sigprocmask(SIG_BLOCK, &sigs, 0);
+
+	int sigfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(sigfd == -1) {
+		perror("failed to create signalfd");
+		evloop.destroy();
+		log_stop();
+		return 1;
+	}
+	/* without the watch nothing would ever read the blocked signals, and only
+	 * SIGKILL could stop us
+	 */
+	if(!evloop.add_fd(sigfd, EV_READ, sig_ready)) {
+		close(sigfd);
+		evloop.destroy();
+		log_stop();
+		return 1;
+	}
+
+	if(!devhost_init(&evloop, false)) {
+		devhost_cleanup();
+		evloop.destroy();
+		close(sigfd);
+		log_stop();
+		return 1;
+	}
+
+	evloop.run();
+
+	const WaitStats &busy = evloop.get_busy_stats();
+	log_info("event loop busy time: mean %.3f p99 %.3f max %.3f msec", busy.get_mean() / 1000.0,
+			busy.get_percentile(99) / 1000.0, busy.get_max() / 1000.0);
+
+	devhost_cleanup();
+	evloop.destroy();
+	close(sigfd);
+	log_stop();
+	return 0;
+}
+
+static void sig_ready(int fd, unsigned int events, void *cls)
+{
+	struct signalfd_siginfo si;
+
+	if(read(fd, &si, sizeof si) == sizeof si) {
+		log_info("caught signal %d, shutting down", (int)si.ssi_signo);
+		evloop.quit();
+	}
+}
+
+static int proc_args(int argc, char **argv)
+{
+	for(int i=1; i<argc; i++) {
+		int res = devhost_parse_arg(argc, argv, i);
+		if(res == -1) {
+			return -1;
+		}
+		if(res > 0) {
+			i += res - 1;
+			continue;
+		}
+
+		if(strcmp(argv[i], "-v") == 0) {
+			log_set_level(LOG_DEBUG);
+			continue;
+		}
+		if(strcmp(argv[i], "-q") == 0) {
+			log_set_level(LOG_WARNING);
+			continue;
+		}
+
+		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			printf("usage: %s [options] <device path> ...\n", argv[0]);
+			printf("options:\n");
+			printf("  -v            verbose, enable debug messages\n");
+			printf("  -q            quiet, only print warnings and errors\n");
+			printf("  -h            print usage and exit\n");
+			devhost_usage();
+			exit(0);
+		}
+
+		fprintf(stderr, "unexpected option: %s\n", argv[i]);
+		return -1;
+	}
+	return 0;
+}
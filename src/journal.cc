@@ -0,0 +1,285 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "logger.h"
+
+#define JOURNAL_MAGIC	"EQJOURN2"
+#define SNAP_MAGIC		"EQSNAPS3"
+#define DEF_CAPACITY	32768	/* records, 1mb journal */
+
+struct JournalHeader {
+	char magic[8];
+	uint32_t rec_size;
+	uint32_t capacity;
+	uint32_t gen;
+	uint32_t pad[11];
+};
+
+/* followed by num_queues SnapshotQueue headers, each one followed by its
+ * waiting tickets and wait time statistics.
+ */
+struct SnapshotHeader {
+	char magic[8];
+	uint32_t gen;		/* journal records up to this generation are included */
+	uint32_t num_queues;
+};
+
+struct SnapshotQueue {
+	int32_t customer, ticket;
+	uint32_t num_waiting;
+};
+
+Journal::Journal()
+{
+	fd = -1;
+	map = 0;
+	map_size = 0;
+	hdr = 0;
+	rec = 0;
+	num_rec = max_rec = 0;
+	gen = 0;
+}
+
+Journal::~Journal()
+{
+	close();
+}
+
+bool Journal::open(const char *path, JournalState *st, int capacity)
+{
+	this->path = path;
+	snap_path = this->path + ".snap";
+
+	uint32_t snap_gen = 0;
+	if(!load_snapshot(st, &snap_gen)) {
+		return false;
+	}
+
+	if((fd = ::open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+		log_error("failed to open journal: %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	/* use the existing journal's layout if there is a valid one */
+	JournalHeader fhdr;
+	bool valid = false;
+	if(pread(fd, &fhdr, sizeof fhdr, 0) == sizeof fhdr && memcmp(fhdr.magic, JOURNAL_MAGIC, 8) == 0 &&
+			fhdr.rec_size == sizeof(JournalRec) && fhdr.capacity > 0) {
+		struct stat stbuf;
+		fstat(fd, &stbuf);
+		valid = (size_t)stbuf.st_size >= sizeof fhdr + fhdr.capacity * sizeof(JournalRec);
+	}
+	if(valid) {
+		max_rec = fhdr.capacity;
+	} else {
+		max_rec = capacity > 0 ? capacity : DEF_CAPACITY;
+	}
+	map_size = sizeof(JournalHeader) + max_rec * sizeof(JournalRec);
+
+	if(!valid && ftruncate(fd, map_size) == -1) {
+		log_error("failed to resize journal: %s: %s", path, strerror(errno));
+		close();
+		return false;
+	}
+
+	if((map = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		log_error("failed to map journal: %s: %s", path, strerror(errno));
+		map = 0;
+		close();
+		return false;
+	}
+	hdr = (JournalHeader*)map;
+	rec = (JournalRec*)(hdr + 1);
+
+	if(!valid) {
+		memset(hdr, 0, sizeof *hdr);
+		memcpy(hdr->magic, JOURNAL_MAGIC, 8);
+		hdr->rec_size = sizeof(JournalRec);
+		hdr->capacity = max_rec;
+		new_generation(snap_gen + 1);
+		return true;
+	}
+
+	if(hdr->gen != snap_gen + 1) {
+		if(hdr->gen > snap_gen + 1) {
+			log_warning("journal %s is newer than its snapshot, discarding it", path);
+		}
+		/* otherwise it's all included in the snapshot already */
+		new_generation(snap_gen + 1);
+		return true;
+	}
+
+	gen = hdr->gen;
+	num_rec = 0;
+	while(num_rec < max_rec && rec[num_rec].gen == gen) {
+		num_rec++;
+	}
+	return true;
+}
+
+void Journal::close()
+{
+	if(map) {
+		munmap(map, map_size);
+		map = 0;
+		hdr = 0;
+		rec = 0;
+	}
+	if(fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+int Journal::get_num_records() const
+{
+	return num_rec;
+}
+
+const JournalRec *Journal::get_record(int idx) const
+{
+	return rec + idx;
+}
+
+void Journal::append(int type, int queue, int id, uint64_t time)
+{
+	if(num_rec >= max_rec) {
+		log_error("journal %s full, event lost", path.c_str());
+		return;
+	}
+
+	JournalRec *r = rec + num_rec++;
+	r->time = time;
+	r->type = type;
+	r->id = id;
+	r->aux = queue;
+	r->pad = 0;
+	/* a record only becomes valid once its generation number is written */
+	__atomic_store_n(&r->gen, gen, __ATOMIC_RELEASE);
+}
+
+bool Journal::is_full() const
+{
+	return num_rec >= max_rec;
+}
+
+bool Journal::snapshot(const JournalState &st)
+{
+	std::string tmp_path = snap_path + ".tmp";
+	FILE *fp = fopen(tmp_path.c_str(), "wb");
+	if(!fp) {
+		log_error("failed to write snapshot: %s: %s", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	SnapshotHeader shdr;
+	memset(&shdr, 0, sizeof shdr);
+	memcpy(shdr.magic, SNAP_MAGIC, 8);
+	shdr.gen = gen;
+	shdr.num_queues = st.queues.size();
+
+	bool ok = fwrite(&shdr, sizeof shdr, 1, fp) == 1;
+	for(size_t i=0; ok && i<st.queues.size(); i++) {
+		const JournalQueueState &qst = st.queues[i];
+
+		SnapshotQueue sq;
+		sq.customer = qst.customer;
+		sq.ticket = qst.ticket;
+		sq.num_waiting = qst.waiting.size();
+
+		ok = fwrite(&sq, sizeof sq, 1, fp) == 1;
+		if(ok && sq.num_waiting) {
+			ok = fwrite(&qst.waiting[0], sizeof(CustStat), sq.num_waiting, fp) == sq.num_waiting;
+		}
+		ok = ok && qst.wstat.write(fp);
+	}
+	ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	fclose(fp);
+
+	if(!ok || rename(tmp_path.c_str(), snap_path.c_str()) == -1) {
+		log_error("failed to write snapshot: %s: %s", snap_path.c_str(), strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+
+	new_generation(gen + 1);
+	return true;
+}
+
+bool Journal::load_snapshot(JournalState *st, uint32_t *snap_gen)
+{
+	st->queues.clear();
+	*snap_gen = 0;
+
+	FILE *fp = fopen(snap_path.c_str(), "rb");
+	if(!fp) {
+		if(errno == ENOENT) {
+			return true;	/* first run */
+		}
+		log_error("failed to open snapshot: %s: %s", snap_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	SnapshotHeader shdr;
+	bool ok = fread(&shdr, sizeof shdr, 1, fp) == 1 && memcmp(shdr.magic, SNAP_MAGIC, 8) == 0 &&
+		shdr.num_queues <= 65536;
+	if(ok) {
+		st->queues.resize(shdr.num_queues);
+	}
+	for(uint32_t i=0; ok && i<shdr.num_queues; i++) {
+		JournalQueueState *qst = &st->queues[i];
+
+		SnapshotQueue sq;
+		if(!(ok = fread(&sq, sizeof sq, 1, fp) == 1)) break;
+
+		qst->customer = sq.customer;
+		qst->ticket = sq.ticket;
+		qst->waiting.resize(sq.num_waiting);
+		if(sq.num_waiting) {
+			ok = fread(&qst->waiting[0], sizeof(CustStat), sq.num_waiting, fp) == sq.num_waiting;
+		}
+		ok = ok && qst->wstat.read(fp);
+	}
+	fclose(fp);
+
+	if(!ok) {
+		log_error("invalid snapshot: %s", snap_path.c_str());
+		st->queues.clear();
+		return false;
+	}
+
+	*snap_gen = shdr.gen;
+	return true;
+}
+
+void Journal::new_generation(uint32_t ngen)
+{
+	gen = ngen;
+	num_rec = 0;
+	/* records of older generations no longer match, no need to clear them */
+	__atomic_store_n(&hdr->gen, gen, __ATOMIC_RELEASE);
+}
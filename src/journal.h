@@ -0,0 +1,99 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "tstore.h"
+#include "waitstat.h"
+
+enum {
+	JREC_ISSUE = 1,		/* ticket issued, id: ticket number */
+	JREC_NEXT,			/* customer served, id: customer number */
+	JREC_RESET			/* queue reset, aux: queue or JREC_ALL_QUEUES */
+};
+
+#define JREC_ALL_QUEUES		0xffffffff
+
+struct JournalRec {
+	uint64_t time;		/* wall clock time in usec */
+	uint32_t gen;		/* generation, written last: marks the record valid */
+	uint32_t type;
+	uint32_t id;
+	uint32_t aux;		/* queue index */
+	uint64_t pad;
+};
+
+struct JournalQueueState {
+	int customer, ticket;
+	std::vector<CustStat> waiting;	/* start times in wall clock usec */
+	WaitStats wstat;
+};
+
+/* everything needed to rebuild the state of all queues, as of a snapshot */
+struct JournalState {
+	std::vector<JournalQueueState> queues;
+};
+
+/* Crash-safe journal of queue events. Every event is appended as a fixed-size
+ * record to a memory-mapped file, so logging costs a few stores and no system
+ * calls, and the records survive the process crashing. When the journal fills
+ * up, a compact snapshot of the whole state is written next to it (to a
+ * temporary file, atomically renamed into place), and the journal starts over
+ * with a new generation number. Recovery loads the snapshot and replays the
+ * journal records of the following generation.
+ */
+class Journal {
+private:
+	int fd;
+	std::string path, snap_path;
+	void *map;
+	size_t map_size;
+	struct JournalHeader *hdr;
+	JournalRec *rec;
+	int num_rec, max_rec;
+	uint32_t gen;
+
+	bool load_snapshot(JournalState *st, uint32_t *snap_gen);
+	void new_generation(uint32_t ngen);
+
+public:
+	Journal();
+	~Journal();
+
+	/* opens or creates the journal, and recovers the state it describes into
+	 * st. Records which must be replayed on top of st are left in the journal,
+	 * see get_num_records/get_record.
+	 */
+	bool open(const char *path, JournalState *st, int capacity = 0);
+	void close();
+
+	int get_num_records() const;
+	const JournalRec *get_record(int idx) const;
+
+	void append(int type, int queue, int id, uint64_t time);
+	bool is_full() const;
+
+	/* writes a snapshot of st, and restarts the journal */
+	bool snapshot(const JournalState &st);
+};
+
+#endif	/* JOURNAL_H_ */
@@ -0,0 +1,246 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include "logger.h"
+
+#define RING_SIZE	1024	/* must be a power of two */
+#define MSG_SIZE	248
+#define OUTBUF_SIZE	16384
+
+/* bounded MPSC queue: each slot carries a sequence number which tells
+ * producers and the consumer whose turn it is to use it.
+ */
+struct LogSlot {
+	std::atomic<unsigned long> seq;
+	int level;
+	int len;
+	char text[MSG_SIZE];
+};
+
+static void *log_thread(void *arg);
+static int format_msg(char *buf, int size, int level, const char *fmt, va_list ap);
+static bool drain();
+
+std::atomic<int> log_level(LOG_INFO);
+
+static LogSlot ring[RING_SIZE];
+static std::atomic<unsigned long> ring_head;	/* next slot to write */
+static unsigned long ring_tail;					/* next slot to read, consumer only */
+static std::atomic<unsigned long> num_dropped;
+
+static pthread_t thread;
+static std::atomic<bool> running, quit;
+static std::atomic<bool> sleeping;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+
+static const char *level_str[] = { "error", "warning", "info", "debug" };
+
+bool log_start()
+{
+	if(running) return true;
+
+	for(int i=0; i<RING_SIZE; i++) {
+		ring[i].seq.store(i, std::memory_order_relaxed);
+	}
+	ring_head.store(0);
+	ring_tail = 0;
+	quit = false;
+
+	/* signals must keep going to the main thread */
+	sigset_t allsig, oldsig;
+	sigfillset(&allsig);
+	pthread_sigmask(SIG_SETMASK, &allsig, &oldsig);
+
+	int res = pthread_create(&thread, 0, log_thread, 0);
+	pthread_sigmask(SIG_SETMASK, &oldsig, 0);
+
+	if(res != 0) {
+		fprintf(stderr, "failed to start logging thread\n");
+		return false;
+	}
+	running = true;
+	return true;
+}
+
+void log_stop()
+{
+	if(!running) return;
+
+	quit = true;
+	pthread_mutex_lock(&wake_lock);
+	pthread_cond_signal(&wake_cond);
+	pthread_mutex_unlock(&wake_lock);
+
+	pthread_join(thread, 0);
+	running = false;
+
+	if(num_dropped) {
+		fprintf(stderr, "log: %lu messages dropped\n", num_dropped.load());
+	}
+}
+
+void log_set_level(int level)
+{
+	log_level.store(level);
+}
+
+int log_get_level()
+{
+	return log_level.load();
+}
+
+unsigned long log_dropped()
+{
+	return num_dropped.load();
+}
+
+void log_msg(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if(!running) {
+		char buf[MSG_SIZE];
+		va_start(ap, fmt);
+		int len = format_msg(buf, sizeof buf, level, fmt, ap);
+		va_end(ap);
+		fwrite(buf, 1, len, stderr);
+		return;
+	}
+
+	/* claim a slot */
+	unsigned long pos = ring_head.load(std::memory_order_relaxed);
+	LogSlot *slot;
+	for(;;) {
+		slot = ring + (pos & (RING_SIZE - 1));
+		unsigned long seq = slot->seq.load(std::memory_order_acquire);
+		long diff = (long)seq - (long)pos;
+
+		if(diff == 0) {
+			if(ring_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if(diff < 0) {
+			/* full, the consumer hasn't caught up with us */
+			num_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = ring_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	va_start(ap, fmt);
+	slot->len = format_msg(slot->text, MSG_SIZE, level, fmt, ap);
+	va_end(ap);
+	slot->level = level;
+	slot->seq.store(pos + 1, std::memory_order_release);
+
+	if(sleeping.load()) {
+		pthread_mutex_lock(&wake_lock);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_lock);
+	}
+}
+
+static int format_msg(char *buf, int size, int level, const char *fmt, va_list ap)
+{
+	int len = snprintf(buf, size, "%s: ", level_str[level]);
+	int res = vsnprintf(buf + len, size - len, fmt, ap);
+	if(res > 0) {
+		len = len + res >= size ? size - 1 : len + res;
+	}
+	if(buf[len - 1] != '\n') {
+		/* add a newline if it's missing, or was truncated away */
+		if(len >= size - 1) len = size - 2;
+		buf[len++] = '\n';
+		buf[len] = 0;
+	}
+	return len;
+}
+
+/* writes out everything in the ring, batched into as few writes as possible.
+ * returns false if there was nothing to write.
+ */
+static bool drain()
+{
+	static char outbuf[OUTBUF_SIZE];
+	int outlen = 0;
+	bool found = false;
+
+	for(;;) {
+		LogSlot *slot = ring + (ring_tail & (RING_SIZE - 1));
+		if(slot->seq.load(std::memory_order_acquire) != ring_tail + 1) {
+			break;
+		}
+
+		if(outlen + slot->len > OUTBUF_SIZE) {
+			fwrite(outbuf, 1, outlen, stderr);
+			outlen = 0;
+		}
+		memcpy(outbuf + outlen, slot->text, slot->len);
+		outlen += slot->len;
+
+		slot->seq.store(ring_tail + RING_SIZE, std::memory_order_release);
+		ring_tail++;
+		found = true;
+	}
+
+	if(outlen) {
+		fwrite(outbuf, 1, outlen, stderr);
+		fflush(stderr);
+	}
+	return found;
+}
+
+static void *log_thread(void *arg)
+{
+	for(;;) {
+		if(drain()) continue;
+		if(quit) break;
+
+		/* nothing to do, go to sleep until a producer wakes us up. The
+		 * timeout is a safety net, not needed for correctness.
+		 */
+		pthread_mutex_lock(&wake_lock);
+		sleeping = true;
+		LogSlot *slot = ring + (ring_tail & (RING_SIZE - 1));
+		if(slot->seq.load() != ring_tail + 1 && !quit) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 100000000;
+			if(ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+		}
+		sleeping = false;
+		pthread_mutex_unlock(&wake_lock);
+	}
+
+	drain();
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <atomic>
+
+enum {
+	LOG_ERROR,
+	LOG_WARNING,
+	LOG_INFO,
+	LOG_DEBUG
+};
+
+/* messages above this level are compiled out entirely */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL	LOG_DEBUG
+#endif
+
+/* Messages are formatted straight into a lock-free ring buffer, and written
+ * out by a background thread, so logging never blocks the caller on a slow
+ * terminal or pipe. If the ring fills up, messages are dropped and counted.
+ * Before log_start (or after log_stop) messages are written synchronously.
+ */
+bool log_start();
+void log_stop();
+
+void log_set_level(int level);
+int log_get_level();
+unsigned long log_dropped();
+
+void log_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+extern std::atomic<int> log_level;
+
+#define LOG_ENABLED(lvl) \
+	((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= log_level.load(std::memory_order_relaxed))
+
+#define log_error(...) \
+	do { if(LOG_ENABLED(LOG_ERROR)) log_msg(LOG_ERROR, __VA_ARGS__); } while(0)
+#define log_warning(...) \
+	do { if(LOG_ENABLED(LOG_WARNING)) log_msg(LOG_WARNING, __VA_ARGS__); } while(0)
+#define log_info(...) \
+	do { if(LOG_ENABLED(LOG_INFO)) log_msg(LOG_INFO, __VA_ARGS__); } while(0)
+#define log_debug(...) \
+	do { if(LOG_ENABLED(LOG_DEBUG)) log_msg(LOG_DEBUG, __VA_ARGS__); } while(0)
+
+#endif	/* LOGGER_H_ */
@@ -18,18 +18,30 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <float.h>
+#include <ctype.h>
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <GL/glew.h>
 #include <X11/Xlib.h>
 #include <GL/glx.h>
 #include "dev.h"
+#include "evloop.h"
+#include "devhost.h"
+#include "logger.h"
 #include "scene.h"
 #include "timer.h"
 #include "fblur.h"
+#include "gpublur.h"
+#include "threadpool.h"
+#include "metrics.h"
+#include "seqlock.h"
+#include "spscq.h"
 
 
 enum {
@@ -41,8 +53,13 @@ void post_redisplay();
 static bool init();
 static void cleanup();
 static void display();
+static void end_stage(int stage, uint64_t *t);
 static void draw_scene(int pass = REGULAR_PASS);
 static void post_glow(void);
+static void resize_glow_pbo();
+static bool read_glow_async();
+static void upload_glow();
+static void start_blur_pool();
 static void keyb(int key, bool pressed);
 static void mouse(int bn, bool pressed, int x, int y);
 static void motion(int x, int y);
@@ -51,6 +68,7 @@ static int next_pow2(int x);
 
 static Window create_window(const char *title, int xsz, int ysz);
 static void process_events();
+static void xev_ready(int fd, unsigned int events, void *cls);
 static int translate_keysym(KeySym sym);
 
 static int proc_args(int argc, char **argv);
@@ -60,13 +78,40 @@ static Window win;
 static GLXContext ctx;
 static Atom xa_wm_prot, xa_wm_del_win;
 
+static EventLoop evloop;
+
 static int win_width, win_height;
 
 static bool draw_pending;
 static bool win_mapped;
 
-static int fakefd = -1;
-static char *fake_devpath;
+#define MIN_REDRAW_INTERVAL		(1000 / 40)		/* 40fps */
+static uint64_t next_frame_usec;
+
+/* the devices and their queue state machines are owned by a separate I/O
+ * thread with its own event loop, so that command latency doesn't depend on
+ * how long it takes to draw a frame. It publishes the state of the device
+ * shown in the window through a seqlock, and the render thread passes button
+ * presses back through a lock-free queue. Each side has an eventfd to wake
+ * the other up.
+ */
+struct DispState {
+	int ticket, customer;
+	uint64_t expiry;	/* until when the ticket is shown, 0 if it isn't */
+};
+
+enum { IOMSG_TICKET, IOMSG_NEXT, IOMSG_QUIT };
+
+static EventLoop io_loop;
+static pthread_t io_thread;
+static bool io_running;
+static int io_wake_fd = -1, render_wake_fd = -1;
+static SeqLock<DispState> disp_pub;
+static SpscQueue<int, 64> io_msgq;
+
+static Device *disp_dev;	/* the device shown in the window, I/O thread only */
+static DispState disp_state;	/* last snapshot of it, render thread only */
+static EvWatch *expiry_timer;	/* redraws when the shown state times out */
 
 static float cam_theta, cam_phi, cam_dist = 140;
 static Scene *scn;
@@ -79,6 +124,10 @@ static Object *led_obj[2];
 static Vector3 led_on_emissive;
 
 static bool opt_use_glow = true;
+static bool opt_gpu_glow = true;	/* blur the glow with shaders, if possible */
+static GpuBlur *gpu_blur;
+static int opt_blur_threads;	/* threads for the CPU blur, 0 for one per processor */
+static ThreadPool *blur_pool;
 #define GLOW_SZ_DIV		3
 static unsigned int glow_tex;
 static int glow_tex_xsz, glow_tex_ysz, glow_xsz, glow_ysz;
@@ -86,61 +135,224 @@ static int glow_iter = 1;
 static int blur_size = 5;
 unsigned char *glow_framebuf;
 
+/* without the GPU blur, the glow image is read back asynchronously through a
+ * pair of pixel buffer objects: each frame queues its own readback, and blurs
+ * the previous frame's, which has completed in the meantime. The glow lags a
+ * frame behind, so every redraw is followed by a catch-up frame.
+ */
+static bool use_glow_pbo;
+static unsigned int glow_pack_pbo[2], glow_unpack_pbo;
+static int glow_pbo_cur;	/* pack buffer to read the next frame into */
+static bool glow_pbo_valid;	/* whether the other one holds the previous frame */
+static bool glow_catchup;	/* the next frame only catches up with the glow */
+
 
 int main(int argc, char **argv)
 {
 	if(proc_args(argc, argv) == -1) {
 		return 1;
 	}
+	log_start();
 	if(!init()) {
+		log_stop();
 		return 1;
 	}
 	atexit(cleanup);
 
-	int xfd = ConnectionNumber(dpy);
+	for(;;) {
+		// Xlib might have queued events while we were busy, which won't wake
+		// up epoll, so drain them before going to sleep
+		process_events();
+
+		// never sleep to cap the frame rate: if it's too early for the next
+		// frame, let the event loop wait until it's due, handling any input
+		// which arrives in the meantime
+		long timeout = -1;
+		if(draw_pending) {
+			uint64_t now = get_time_usec();
+			if(now >= next_frame_usec) {
+				draw_pending = false;
+				display();
+				next_frame_usec = now + MIN_REDRAW_INTERVAL * 1000;
+				now = get_time_usec();
+			}
+			if(draw_pending) {
+				timeout = now < next_frame_usec ? (next_frame_usec - now + 999) / 1000 : 0;
+			}
+		}
 
-	// run once through pending events before going into the select loop
-	process_events();
+		if(evloop.run_once(timeout) == -1) {
+			break;
+		}
+	}
+	return 1;
+}
 
-	for(;;) {
-		fd_set rd;
-		FD_ZERO(&rd);
+void post_redisplay()
+{
+	draw_pending = true;
+	glow_catchup = false;
+}
 
-		FD_SET(xfd, &rd);
-		FD_SET(fakefd, &rd);
+static void state_expired(void *cls)
+{
+	post_redisplay();
+}
 
-		struct timeval noblock = {0, 0};
-		int maxfd = xfd > fakefd ? xfd : fakefd;
-		while(!XPending(dpy) && select(maxfd + 1, &rd, 0, 0, draw_pending ? &noblock : 0) == -1 && errno == EINTR);
+static void wake(int fd)
+{
+	uint64_t one = 1;
+	while(write(fd, &one, sizeof one) == -1 && errno == EINTR);
+}
 
-		if(XPending(dpy) || FD_ISSET(xfd, &rd)) {
-			process_events();
-		}
-		if(FD_ISSET(fakefd, &rd)) {
-			proc_dev_input();
-		}
+static void drain_wakeups(int fd)
+{
+	uint64_t count;
+	while(read(fd, &count, sizeof count) == -1 && errno == EINTR);
+}
 
-		if(draw_pending) {
-			draw_pending = false;
-			display();
+// I/O thread: publish the new state of the displayed device
+static void dev_changed(Device *dev, void *cls)
+{
+	DispState st;
+	st.ticket = dev->get_ticket();
+	st.customer = dev->get_customer();
+	st.expiry = dev->get_state_expiry();
+	disp_pub.write(st);
+
+	wake(render_wake_fd);
+}
+
+// render thread: pick up the latest published state and redraw
+static void state_published(int fd, unsigned int events, void *cls)
+{
+	drain_wakeups(fd);
+	disp_state = disp_pub.read();
+	post_redisplay();
+
+	// schedule exactly one more redraw for when the ticket display times out,
+	// instead of redrawing continuously until then
+	if(disp_state.expiry) {
+		uint64_t now = get_time_usec();
+		uint64_t expiry = disp_state.expiry;
+		long msec = expiry > now ? (long)((expiry - now + 999) / 1000) : 1;
+		evloop.start_timer(expiry_timer, msec);
+	} else {
+		evloop.stop_timer(expiry_timer);
+	}
+}
+
+// render thread: pass a message to the I/O thread
+static void send_io_msg(int msg)
+{
+	if(!io_msgq.push(msg)) {
+		log_warning("I/O thread message queue full, dropping message %d", msg);
+		return;
+	}
+	wake(io_wake_fd);
+}
+
+// I/O thread: handle messages from the render thread
+static void io_msg_ready(int fd, unsigned int events, void *cls)
+{
+	int msg;
+	bool changed = false;
+
+	drain_wakeups(fd);
+	while(io_msgq.pop(&msg)) {
+		switch(msg) {
+		case IOMSG_TICKET:
+			disp_dev->issue_ticket();
+			changed = true;
+			break;
+
+		case IOMSG_NEXT:
+			disp_dev->next_customer();
+			changed = true;
+			break;
+
+		case IOMSG_QUIT:
+			io_loop.quit();
+			break;
 		}
 	}
+	if(changed) {
+		devhost_flush(disp_dev);
+	}
+}
+
+static void *io_thread_func(void *arg)
+{
+	io_loop.run();
 	return 0;
 }
 
-void post_redisplay()
+static bool start_io_thread()
 {
-	draw_pending = true;
+	// signals are for the main thread to handle
+	sigset_t sset, oldset;
+	sigfillset(&sset);
+	pthread_sigmask(SIG_BLOCK, &sset, &oldset);
+
+	int res = pthread_create(&io_thread, 0, io_thread_func, 0);
+	pthread_sigmask(SIG_SETMASK, &oldset, 0);
+
+	if(res != 0) {
+		fprintf(stderr, "failed to start the I/O thread: %s\n", strerror(res));
+		return false;
+	}
+	io_running = true;
+	return true;
+}
+
+static void stop_io_thread()
+{
+	if(!io_running) return;
+
+	// the queue might be full if the I/O thread got stuck, keep trying
+	while(!io_msgq.push(IOMSG_QUIT)) {
+		wait_for(1);
+	}
+	wake(io_wake_fd);
+	pthread_join(io_thread, 0);
+	io_running = false;
+}
+
+static void log_busy_stats(const char *name, const EventLoop &loop)
+{
+	const WaitStats &busy = loop.get_busy_stats();
+	log_info("%s event loop busy time: mean %.3f p99 %.3f max %.3f msec", name, busy.get_mean() / 1000.0,
+			busy.get_percentile(99) / 1000.0, busy.get_max() / 1000.0);
 }
 
 static bool init()
 {
-	if(fake_devpath) {
-		if((fakefd = start_dev(fake_devpath)) == -1) {
-			return false;
-		}
+	if(!evloop.init() || !io_loop.init()) {
+		return false;
+	}
+
+	if((io_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+			(render_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("failed to create eventfd");
+		return false;
+	}
+	if(!io_loop.add_fd(io_wake_fd, EV_READ, io_msg_ready) ||
+			!evloop.add_fd(render_wake_fd, EV_READ, state_published)) {
+		return false;
 	}
 
+	// without any devices we run standalone, driven only by the on-screen buttons
+	if(!devhost_init(&io_loop, true)) {
+		return false;
+	}
+	disp_dev = devhost_device(0);
+	disp_dev->change_func = dev_changed;
+	if(!(expiry_timer = evloop.add_timer(state_expired))) {
+		return false;
+	}
+	// publish the initial state, which might have been restored from a journal
+	dev_changed(disp_dev, 0);
+
 	if(!(dpy = XOpenDisplay(0))) {
 		fprintf(stderr, "failed to connect to the X server!\n");
 		return false;
@@ -149,6 +361,9 @@ static bool init()
 	if(!(win = create_window("equeue device emulator", 512, 512))) {
 		return false;
 	}
+	if(!evloop.add_fd(ConnectionNumber(dpy), EV_READ, xev_ready)) {
+		return false;
+	}
 
 	glewInit();
 
@@ -194,6 +409,23 @@ static bool init()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 64, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
 
+	// the CPU blur is the fallback, if framebuffer objects or shaders are missing
+	if(opt_use_glow && opt_gpu_glow) {
+		if(!GpuBlur::is_supported()) {
+			log_warning("no framebuffer object or GLSL support, blurring the glow on the CPU");
+		} else {
+			gpu_blur = new GpuBlur;
+			if(!gpu_blur->init(blur_size)) {
+				log_warning("failed to set up the GPU blur, blurring the glow on the CPU");
+				delete gpu_blur;
+				gpu_blur = 0;
+			}
+		}
+	}
+	if(opt_use_glow) {
+		log_info("glow blur on the %s", gpu_blur ? "GPU" : "CPU");
+	}
+
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_LIGHTING);
@@ -201,14 +433,30 @@ static bool init()
 
 	glClearColor(0.1, 0.1, 0.1, 1);
 
-	return true;
+	// from here on the devices belong to the I/O thread
+	return start_io_thread();
 }
 
 static void cleanup()
 {
+	stop_io_thread();
+
+	log_busy_stats("render", evloop);
+	log_busy_stats("I/O", io_loop);
+
 	delete scn;
+	delete gpu_blur;
+	fast_blur_use_pool(0);
+	delete blur_pool;
+	if(use_glow_pbo) {
+		glDeleteBuffers(2, glow_pack_pbo);
+		glDeleteBuffers(1, &glow_unpack_pbo);
+	}
 
-	stop_dev();
+	devhost_cleanup();
+	io_loop.destroy();
+	if(io_wake_fd != -1) close(io_wake_fd);
+	if(render_wake_fd != -1) close(render_wake_fd);
 
 	if(!dpy) return;
 
@@ -216,13 +464,18 @@ static void cleanup()
 		XDestroyWindow(dpy, win);
 	}
 	XCloseDisplay(dpy);
+
+	evloop.destroy();
+	log_stop();
 }
 
 #define DIGIT_USZ	(1.0 / 11.0)
-#define MIN_REDRAW_INTERVAL		(1000 / 40)		/* 40fps */
 
 static void display()
 {
+	uint64_t frame_start = metrics ? get_time_usec() : 0;
+	uint64_t t = frame_start;
+
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
 	glTranslatef(0, 0, -cam_dist);
@@ -232,49 +485,89 @@ static void display()
 	float lpos[] = {-7, 5, 10, 0};
 	glLightfv(GL_LIGHT0, GL_POSITION, lpos);
 
-	if(opt_use_glow) {
+	bool have_glow = opt_use_glow;
+
+	if(gpu_blur) {
+		// render the glow pass offscreen, it never leaves the GPU
+		gpu_blur->begin();
+
+		glClearColor(0, 0, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		draw_scene(GLOW_PASS);
+		gpu_blur->end();
+		glViewport(0, 0, win_width, win_height);
+		end_stage(FSTAGE_GLOW_RENDER, &t);
+
+	} else if(opt_use_glow) {
 		glViewport(0, 0, glow_xsz, glow_ysz);
 
 		glClearColor(0, 0, 0, 1);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		draw_scene(GLOW_PASS);
+		end_stage(FSTAGE_GLOW_RENDER, &t);
 
-		glReadPixels(0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, glow_framebuf);
+		if(use_glow_pbo) {
+			have_glow = read_glow_async();
+		} else {
+			glReadPixels(0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, glow_framebuf);
+		}
 		glViewport(0, 0, win_width, win_height);
+		end_stage(FSTAGE_READBACK, &t);
 	}
 
 	glClearColor(0.05, 0.05, 0.05, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	draw_scene();
+	end_stage(FSTAGE_SCENE, &t);
 
-	if(opt_use_glow) {
+	if(have_glow) {
 		for(int i=0; i<glow_iter; i++) {
-			fast_blur(BLUR_BOTH, blur_size, (uint32_t*)glow_framebuf, glow_xsz, glow_ysz);
-			glBindTexture(GL_TEXTURE_2D, glow_tex);
-			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, glow_framebuf);
+			if(gpu_blur) {
+				gpu_blur->blur();
+				end_stage(FSTAGE_BLUR, &t);
+			} else {
+				fast_blur(BLUR_BOTH, blur_size, (uint32_t*)glow_framebuf, glow_xsz, glow_ysz);
+				end_stage(FSTAGE_BLUR, &t);
+
+				upload_glow();
+			}
 
 			post_glow();
+			end_stage(FSTAGE_GLOW_APPLY, &t);
 		}
 	}
 
-	if(get_led_state(0)) {
-		// continuously redraw until the left LED times out
-		draw_pending = true;
-	}
-
 	glXSwapBuffers(dpy, win);
 	assert(glGetError() == GL_NO_ERROR);
+	end_stage(FSTAGE_SWAP, &t);
 
-	static long prev_msec;
-	long msec = get_msec();
-	long dt = msec - prev_msec;
+	if(use_glow_pbo && !gpu_blur) {
+		// draw once more, to show the glow of what we just drew
+		if(glow_catchup) {
+			glow_catchup = false;
+		} else {
+			post_redisplay();
+			glow_catchup = true;
+		}
+	}
 
-	if(dt < MIN_REDRAW_INTERVAL) {
-		wait_for(MIN_REDRAW_INTERVAL - dt);
+	if(metrics) {
+		metric_add(&metrics->frame_usec, t - frame_start);
+		metric_add(&metrics->frames, 1);
 	}
-	prev_msec = get_msec();
+}
+
+// adds the time since *t to the frame stage, and restarts *t
+static void end_stage(int stage, uint64_t *t)
+{
+	if(!metrics) return;
+
+	uint64_t now = get_time_usec();
+	metric_add(&metrics->stage_usec[stage], now - *t);
+	*t = now;
 }
 
 static void draw_scene(int pass)
@@ -283,10 +576,14 @@ static void draw_scene(int pass)
 		scn->render();
 	}
 
+	// same rules as Device::get_display_number and get_led_state, applied to
+	// the last state published by the I/O thread
+	bool showing_ticket = get_time_usec() < disp_state.expiry;
+
 	// shift the textures and modify the materials to make the display match our state
 	for(int i=0; i<2; i++) {
 		// 7seg
-		int digit = get_display_number();
+		int digit = showing_ticket ? disp_state.ticket : disp_state.customer;
 		for(int j=0; j<i; j++) {
 			digit /= 10;
 		}
@@ -298,7 +595,7 @@ static void draw_scene(int pass)
 		disp_obj[i]->render();
 
 		// LEDs
-		if(get_led_state(i)) {
+		if(i == (showing_ticket ? 0 : 1)) {
 			led_obj[i]->mtl.emissive = led_on_emissive;
 		} else {
 			led_obj[i]->mtl.emissive = Vector3(0, 0, 0);
@@ -328,7 +625,7 @@ static void post_glow(void)
 	glLoadIdentity();
 
 	glEnable(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, glow_tex);
+	glBindTexture(GL_TEXTURE_2D, gpu_blur ? gpu_blur->get_texture() : glow_tex);
 
 	glBegin(GL_QUADS);
 	glColor4f(1, 1, 1, 1);
@@ -349,6 +646,86 @@ static void post_glow(void)
 	glPopAttrib();
 }
 
+// (re)allocates the readback buffers for the current glow image size
+static void resize_glow_pbo()
+{
+	if(!glow_pack_pbo[0]) {
+		if(!GLEW_ARB_pixel_buffer_object) {
+			log_info("no pixel buffer object support, reading back the glow synchronously");
+			return;
+		}
+		glGenBuffers(2, glow_pack_pbo);
+		glGenBuffers(1, &glow_unpack_pbo);
+		use_glow_pbo = true;
+	}
+
+	int size = glow_xsz * glow_ysz * 4;
+	for(int i=0; i<2; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, glow_pack_pbo[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// whatever is in flight has the wrong size now
+	glow_pbo_valid = false;
+}
+
+// queues the readback of this frame's glow image, and copies the previous
+// frame's into glow_framebuf. Returns false if there's no previous frame.
+static bool read_glow_async()
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, glow_pack_pbo[glow_pbo_cur]);
+	glReadPixels(0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glow_pbo_cur = !glow_pbo_cur;
+
+	bool res = false;
+	if(glow_pbo_valid) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, glow_pack_pbo[glow_pbo_cur]);
+		void *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if(pixels) {
+			memcpy(glow_framebuf, pixels, glow_xsz * glow_ysz * 4);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			res = true;
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glow_pbo_valid = true;
+	return res;
+}
+
+static void upload_glow()
+{
+	glBindTexture(GL_TEXTURE_2D, glow_tex);
+
+	if(use_glow_pbo) {
+		// the pixels are copied into a fresh buffer, and the texture is
+		// updated from it without waiting for the GPU to finish with the last one
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, glow_unpack_pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, glow_xsz * glow_ysz * 4, glow_framebuf, GL_STREAM_DRAW);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, glow_xsz, glow_ysz, GL_RGBA, GL_UNSIGNED_BYTE, glow_framebuf);
+	}
+}
+
+// starts the threads the CPU blur is split across, the first time it's needed
+static void start_blur_pool()
+{
+	if(blur_pool || opt_blur_threads == 1) return;
+
+	blur_pool = new ThreadPool;
+	if(!blur_pool->start(opt_blur_threads)) {
+		log_warning("failed to start the blur threads, blurring the glow on the render thread");
+		delete blur_pool;
+		blur_pool = 0;
+		opt_blur_threads = 1;
+		return;
+	}
+	fast_blur_use_pool(blur_pool);
+	log_info("CPU glow blur on %d threads", blur_pool->get_num_threads());
+}
 
 static void reshape(int x, int y)
 {
@@ -364,15 +741,29 @@ static void reshape(int x, int y)
 	if(opt_use_glow) {
 		glow_xsz = x / GLOW_SZ_DIV;
 		glow_ysz = y / GLOW_SZ_DIV;
-		printf("glow image size: %dx%d\n", glow_xsz, glow_ysz);
+		log_info("glow image size: %dx%d", glow_xsz, glow_ysz);
 
-		delete [] glow_framebuf;
-		glow_framebuf = new unsigned char[glow_xsz * glow_ysz * 4];
+		if(gpu_blur && !gpu_blur->resize(glow_xsz, glow_ysz)) {
+			log_warning("falling back to blurring the glow on the CPU");
+			delete gpu_blur;
+			gpu_blur = 0;
+		}
+
+		if(gpu_blur) {
+			// the offscreen textures are exactly the size of the glow image
+			glow_tex_xsz = glow_xsz;
+			glow_tex_ysz = glow_ysz;
+		} else {
+			delete [] glow_framebuf;
+			glow_framebuf = new unsigned char[glow_xsz * glow_ysz * 4];
+			resize_glow_pbo();
+			start_blur_pool();
 
-		glow_tex_xsz = next_pow2(glow_xsz);
-		glow_tex_ysz = next_pow2(glow_ysz);
-		glBindTexture(GL_TEXTURE_2D, glow_tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, glow_tex_xsz, glow_tex_ysz, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+			glow_tex_xsz = next_pow2(glow_xsz);
+			glow_tex_ysz = next_pow2(glow_ysz);
+			glBindTexture(GL_TEXTURE_2D, glow_tex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, glow_tex_xsz, glow_tex_ysz, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		}
 	}
 }
 
@@ -414,14 +805,13 @@ static void mouse(int bn, bool pressed, int x, int y)
 		if(hit_found != -1) {
 			switch(hit_found) {
 			case BN_TICKET:
-				issue_ticket();
+				send_io_msg(IOMSG_TICKET);
 				break;
 
 			case BN_NEXT:
-				next_customer();
+				send_io_msg(IOMSG_NEXT);
 				break;
 			}
-			draw_pending = true;
 		}
 	}
 }
@@ -449,7 +839,7 @@ static void motion(int x, int y)
 		cam_theta = -xoffs * 15.0 * (win_width / win_height);
 		cam_phi = -yoffs * 15.0;
 	}
-	draw_pending = true;
+	post_redisplay();
 }
 
 static Ray calc_pick_ray(int x, int y)
@@ -571,7 +961,7 @@ static void process_events()
 
 		case Expose:
 			if(win_mapped && ev.xexpose.count == 0) {
-				draw_pending = true;
+				post_redisplay();
 			}
 			break;
 
@@ -625,7 +1015,7 @@ static void process_events()
 		case LeaveNotify:
 			if(ev.xcrossing.mode == NotifyNormal) {
 				cam_theta = cam_phi = 0;
-				draw_pending = true;
+				post_redisplay();
 			}
 			break;
 
@@ -636,6 +1026,11 @@ static void process_events()
 	}
 }
 
+static void xev_ready(int fd, unsigned int events, void *cls)
+{
+	process_events();
+}
+
 static int translate_keysym(KeySym sym)
 {
 	switch(sym) {
@@ -658,20 +1053,66 @@ static int translate_keysym(KeySym sym)
 static int proc_args(int argc, char **argv)
 {
 	for(int i=1; i<argc; i++) {
-		if(argv[i][0] == '-') {
-			fprintf(stderr, "unexpected option: %s\n", argv[i]);
+		int res = devhost_parse_arg(argc, argv, i);
+		if(res == -1) {
 			return -1;
+		}
+		if(res > 0) {
+			i += res - 1;
+			continue;
+		}
 
-		} else {
-			if(fake_devpath) {
-				fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+		if(strcmp(argv[i], "-v") == 0) {
+			log_set_level(LOG_DEBUG);
+			continue;
+		}
+		if(strcmp(argv[i], "-q") == 0) {
+			log_set_level(LOG_WARNING);
+			continue;
+		}
+
+		if(strcmp(argv[i], "-glow") == 0) {
+			const char *mode = ++i < argc ? argv[i] : "";
+			if(strcmp(mode, "gpu") == 0) {
+				opt_use_glow = opt_gpu_glow = true;
+			} else if(strcmp(mode, "cpu") == 0) {
+				opt_use_glow = true;
+				opt_gpu_glow = false;
+			} else if(strcmp(mode, "off") == 0) {
+				opt_use_glow = false;
+			} else {
+				fprintf(stderr, "-glow must be followed by gpu, cpu or off\n");
 				return -1;
 			}
-			fake_devpath = argv[i];
+			continue;
 		}
-	}
-	if(!fake_devpath) {
-		fprintf(stderr, "no device path specified, running standalone\n");
+
+		if(strcmp(argv[i], "-blur-threads") == 0) {
+			if(++i >= argc || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-blur-threads must be followed by the number of threads\n");
+				return -1;
+			}
+			opt_blur_threads = atoi(argv[i]);
+			continue;
+		}
+
+		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			printf("usage: %s [options] [device path] ...\n", argv[0]);
+			printf("options:\n");
+			printf("  -v            verbose, enable debug messages\n");
+			printf("  -q            quiet, only print warnings and errors\n");
+			printf("  -glow <mode>  blur the glow on the gpu (default, if supported), the\n");
+			printf("                cpu, or turn it off\n");
+			printf("  -blur-threads <n>\n");
+			printf("                threads to split the cpu glow blur across, 0 for one\n");
+			printf("                per processor (default)\n");
+			printf("  -h            print usage and exit\n");
+			devhost_usage();
+			exit(0);
+		}
+
+		fprintf(stderr, "unexpected option: %s\n", argv[i]);
+		return -1;
 	}
 	return 0;
 }
@@ -0,0 +1,95 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "metrics.h"
+#include "timer.h"
+#include "logger.h"
+
+Metrics *metrics;
+
+static char *shm_name;
+static size_t shm_size;
+
+bool metrics_init(const char *name, int num_devices)
+{
+	int fd;
+
+	shm_size = sizeof(Metrics) + num_devices * sizeof(MetricsDev);
+
+	if((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+		log_error("failed to create shared memory segment %s: %s", name, strerror(errno));
+		return false;
+	}
+	if(ftruncate(fd, shm_size) == -1) {
+		log_error("failed to resize shared memory segment %s: %s", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+
+	void *map = mmap(0, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		log_error("failed to map shared memory segment %s: %s", name, strerror(errno));
+		shm_unlink(name);
+		return false;
+	}
+	shm_name = strdup(name);
+
+	/* freshly truncated, so it's all zeros. fill in the header last, to let
+	 * any reader which is already polling for it see a complete segment.
+	 */
+	Metrics *m = (Metrics*)map;
+	m->size = shm_size;
+	m->num_devices = num_devices;
+	m->dev_size = sizeof(MetricsDev);
+	m->pid = getpid();
+	m->start_time = get_wall_usec();
+	m->version = METRICS_VERSION;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(m->magic, METRICS_MAGIC, 8);
+
+	metrics = m;
+	log_info("publishing metrics in shared memory segment %s", name);
+	return true;
+}
+
+void metrics_cleanup()
+{
+	if(!metrics) return;
+
+	munmap(metrics, shm_size);
+	metrics = 0;
+	shm_unlink(shm_name);
+	free(shm_name);
+	shm_name = 0;
+}
+
+MetricsDev *metrics_device(int idx)
+{
+	if(!metrics || idx < 0 || idx >= (int)metrics->num_devices) {
+		return 0;
+	}
+	return (MetricsDev*)(metrics + 1) + idx;
+}
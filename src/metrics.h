@@ -0,0 +1,97 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <inttypes.h>
+
+/* Live metrics, in a POSIX shared memory segment which monitoring tools (see
+ * tools/eqmon) map read-only. Updating them costs a few plain stores, no
+ * system calls. Every field has a single writer; counters only ever increase,
+ * so readers compute rates from the difference between two samples.
+ *
+ * Layout: Metrics header, followed by num_devices MetricsDev structures.
+ * Readers must check the magic and version, and use dev_size as the stride of
+ * the device array.
+ */
+#define METRICS_MAGIC		"EQMETRIC"
+#define METRICS_VERSION		1
+
+#define METRICS_NUM_CMDS	27	/* commands 'a' to 'z', then everything else */
+
+enum {
+	FSTAGE_GLOW_RENDER,		/* rendering the glowing parts */
+	FSTAGE_READBACK,		/* reading them back for blurring */
+	FSTAGE_SCENE,
+	FSTAGE_BLUR,
+	FSTAGE_GLOW_APPLY,		/* uploading and blending the blurred glow */
+	FSTAGE_SWAP,
+
+	NUM_FRAME_STAGES
+};
+
+struct MetricsDev {
+	uint64_t cmds[METRICS_NUM_CMDS];
+	uint64_t bytes_in, bytes_out, bytes_dropped;
+	uint64_t tickets, served;
+	int64_t queue_depth;	/* gauge: ticket - customer */
+};
+
+struct Metrics {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;			/* of the whole segment */
+	uint32_t num_devices;
+	uint32_t dev_size;
+	uint32_t pid;			/* of the emulator writing them */
+	uint32_t pad;
+	uint64_t start_time;	/* wall clock usec */
+
+	uint64_t frames;
+	uint64_t frame_usec;	/* total time spent drawing frames */
+	uint64_t stage_usec[NUM_FRAME_STAGES];
+};
+
+extern Metrics *metrics;	/* 0 if metrics are disabled */
+
+/* creates the shared memory segment name (e.g. "/eqemu") */
+bool metrics_init(const char *name, int num_devices);
+void metrics_cleanup();
+
+MetricsDev *metrics_device(int idx);
+
+/* single writer per field: relaxed stores keep readers from seeing torn
+ * values, without any read-modify-write cycles on the bus.
+ */
+inline void metric_add(uint64_t *m, uint64_t val)
+{
+	__atomic_store_n(m, *m + val, __ATOMIC_RELAXED);
+}
+
+inline void metric_set(uint64_t *m, uint64_t val)
+{
+	__atomic_store_n(m, val, __ATOMIC_RELAXED);
+}
+
+inline void metric_set(int64_t *m, int64_t val)
+{
+	__atomic_store_n(m, val, __ATOMIC_RELAXED);
+}
+
+#endif	/* METRICS_H_ */
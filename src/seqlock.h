@@ -0,0 +1,81 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <string.h>
+#include <inttypes.h>
+
+/* Single-writer sequence lock, for publishing small snapshots of state to
+ * other threads. The writer never waits; readers retry if they raced with an
+ * update, so they always get a consistent copy. T must be trivially copyable.
+ * The data is copied a word at a time with relaxed atomics, to keep racing
+ * readers well-defined.
+ */
+template <typename T>
+class SeqLock {
+private:
+	enum { NWORDS = (sizeof(T) + 3) / 4 };
+
+	uint32_t seq;		/* odd while an update is in progress */
+	uint32_t data[NWORDS];
+
+public:
+	SeqLock()
+	{
+		seq = 0;
+		memset(data, 0, sizeof data);
+	}
+
+	/* must only ever be called from the same thread */
+	void write(const T &val)
+	{
+		uint32_t buf[NWORDS] = {0};
+		memcpy(buf, &val, sizeof val);
+
+		uint32_t s = seq;
+		__atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		for(int i=0; i<NWORDS; i++) {
+			__atomic_store_n(data + i, buf[i], __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+	}
+
+	T read() const
+	{
+		uint32_t buf[NWORDS];
+		uint32_t s0, s1;
+
+		do {
+			s0 = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+			for(int i=0; i<NWORDS; i++) {
+				buf[i] = __atomic_load_n(data + i, __ATOMIC_RELAXED);
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			s1 = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+		} while((s0 & 1) || s0 != s1);
+
+		T res;
+		memcpy(&res, buf, sizeof res);
+		return res;
+	}
+};
+
+#endif	/* SEQLOCK_H_ */
@@ -0,0 +1,64 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPSCQ_H_
+#define SPSCQ_H_
+
+/* Lock-free bounded queue for exactly one producer and one consumer thread.
+ * SIZE must be a power of two. The indices run freely and wrap around, and
+ * each one is only written by one side, on its own cache line.
+ */
+template <typename T, int SIZE>
+class SpscQueue {
+private:
+	T items[SIZE];
+	unsigned int head __attribute__((aligned(64)));		/* next to pop, consumer */
+	unsigned int tail __attribute__((aligned(64)));		/* next to push, producer */
+
+public:
+	SpscQueue()
+	{
+		head = tail = 0;
+	}
+
+	/* producer: returns false if the queue is full */
+	bool push(const T &item)
+	{
+		unsigned int t = tail;
+		if(t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) >= (unsigned int)SIZE) {
+			return false;
+		}
+		items[t & (SIZE - 1)] = item;
+		__atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/* consumer: returns false if the queue is empty */
+	bool pop(T *item)
+	{
+		unsigned int h = head;
+		if(h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+		*item = items[h & (SIZE - 1)];
+		__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+
+#endif	/* SPSCQ_H_ */
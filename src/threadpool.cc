@@ -0,0 +1,167 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "threadpool.h"
+#include "logger.h"
+
+ThreadPool::ThreadPool()
+{
+	pthread_mutex_init(&mutex, 0);
+	pthread_cond_init(&start_cond, 0);
+	pthread_cond_init(&done_cond, 0);
+
+	job_func = 0;
+	job_cls = 0;
+	num_jobs = next_job = 0;
+	active = 0;
+	gen = 0;
+	quit = false;
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&start_cond);
+	pthread_cond_destroy(&done_cond);
+}
+
+bool ThreadPool::start(int num_threads)
+{
+	stop();
+
+	if(num_threads <= 0) {
+		long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = nproc > 0 ? nproc : 1;
+	}
+
+	/* signals are for the main thread to handle */
+	sigset_t sset, oldset;
+	sigfillset(&sset);
+	pthread_sigmask(SIG_BLOCK, &sset, &oldset);
+
+	quit = false;
+	for(int i=0; i<num_threads - 1; i++) {
+		pthread_t thr;
+		int res = pthread_create(&thr, 0, thread_func, this);
+		if(res != 0) {
+			log_error("failed to create worker thread: %s", strerror(res));
+			pthread_sigmask(SIG_SETMASK, &oldset, 0);
+			stop();
+			return false;
+		}
+		workers.push_back(thr);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, 0);
+
+	log_debug("thread pool started with %d workers", (int)workers.size());
+	return true;
+}
+
+void ThreadPool::stop()
+{
+	if(workers.empty()) return;
+
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&mutex);
+
+	for(size_t i=0; i<workers.size(); i++) {
+		pthread_join(workers[i], 0);
+	}
+	workers.clear();
+}
+
+int ThreadPool::get_num_threads() const
+{
+	return (int)workers.size() + 1;
+}
+
+void ThreadPool::run(int count, void (*func)(int, void*), void *cls)
+{
+	if(workers.empty() || count <= 1) {
+		for(int i=0; i<count; i++) {
+			func(i, cls);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&mutex);
+	job_func = func;
+	job_cls = cls;
+	num_jobs = count;
+	next_job = 0;
+	active = (int)workers.size();
+	gen++;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&mutex);
+
+	work(func, cls, count);
+
+	/* every worker has to check in before the next run can reuse the job
+	 * state, even if there was nothing left for it to do
+	 */
+	pthread_mutex_lock(&mutex);
+	while(active > 0) {
+		pthread_cond_wait(&done_cond, &mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void ThreadPool::work(void (*func)(int, void*), void *cls, int count)
+{
+	int idx;
+	while((idx = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < count) {
+		func(idx, cls);
+	}
+}
+
+void *ThreadPool::thread_func(void *arg)
+{
+	ThreadPool *pool = (ThreadPool*)arg;
+	unsigned long last_gen = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for(;;) {
+		while(pool->gen == last_gen && !pool->quit) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		}
+		if(pool->quit) break;
+		last_gen = pool->gen;
+
+		void (*func)(int, void*) = pool->job_func;
+		void *cls = pool->job_cls;
+		int count = pool->num_jobs;
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool->work(func, cls, count);
+
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->active == 0) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <pthread.h>
+
+/* Persistent pool of worker threads, for splitting a piece of work into
+ * independent jobs. run() hands out job indices to the workers and the
+ * calling thread alike, and returns when all of them are done, so the
+ * workers sleep between runs instead of being created every time. Which
+ * thread runs which job varies, so jobs must not depend on each other.
+ */
+class ThreadPool {
+private:
+	std::vector<pthread_t> workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond, done_cond;
+
+	/* the current run, protected by mutex, except for next_job */
+	void (*job_func)(int, void*);
+	void *job_cls;
+	int num_jobs;
+	int next_job;
+	int active;		/* workers still busy with the current run */
+	unsigned long gen;	/* incremented for every run */
+	bool quit;
+
+	static void *thread_func(void *arg);
+	void work(void (*func)(int, void*), void *cls, int count);
+
+public:
+	ThreadPool();
+	~ThreadPool();
+
+	/* total number of threads including the caller of run(), 0 for one per
+	 * processor. A single thread means no workers: run() does all the jobs.
+	 */
+	bool start(int num_threads = 0);
+	void stop();
+
+	int get_num_threads() const;
+
+	/* calls func(i, cls) for every i in [0, count), and waits for all of them */
+	void run(int count, void (*func)(int, void*), void *cls);
+};
+
+#endif	/* THREADPOOL_H_ */
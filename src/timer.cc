@@ -16,20 +16,55 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <time.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include "timer.h"
+
+/* per thread, so that each thread running an event loop has its own "now" */
+static __thread uint64_t now_usec;
+
+uint64_t get_time_nsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t get_time_usec()
+{
+	return get_time_nsec() / 1000;
+}
 
 unsigned long get_msec()
 {
-	static struct timeval tv0;
-	struct timeval tv;
+	return (unsigned long)(get_time_nsec() / 1000000);
+}
+
+uint64_t update_now()
+{
+	return now_usec = get_time_usec();
+}
 
-	gettimeofday(&tv, 0);
-	if(tv0.tv_sec == 0 && tv0.tv_usec == 0) {
-		tv0 = tv;
-		return 0;
-	}
-	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+void set_now(uint64_t usec)
+{
+	now_usec = usec;
+}
+
+uint64_t get_now_usec()
+{
+	return now_usec ? now_usec : get_time_usec();
+}
+
+unsigned long get_now_msec()
+{
+	return (unsigned long)(get_now_usec() / 1000);
+}
+
+uint64_t get_wall_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 void wait_for(unsigned long msec)
@@ -19,7 +19,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef TIMER_H_
 #define TIMER_H_
 
+#include <inttypes.h>
+
+/* monotonic clock: unaffected by changes to the wall clock, and counting from
+ * an arbitrary point in the past (never 0 in practice).
+ */
+uint64_t get_time_nsec();
+uint64_t get_time_usec();
 unsigned long get_msec();
+
+/* cached monotonic time, as of the last update_now call. The event loop calls
+ * update_now once per iteration, so everything handled in one iteration
+ * agrees on the current time, without reading the clock again. Before the
+ * first update, get_now_* read the clock directly.
+ */
+uint64_t update_now();
+uint64_t get_now_usec();
+unsigned long get_now_msec();
+/* sets the cached time to an arbitrary value, to run devices on a virtual
+ * clock (e.g. replaying a recorded session). Stays in effect until the next
+ * update_now.
+ */
+void set_now(uint64_t usec);
+
+/* wall clock time, for timestamps which have to outlive the process */
+uint64_t get_wall_usec();
+
 void wait_for(unsigned long msec);
 
 #endif	/* TIMER_H_ */
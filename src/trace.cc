@@ -0,0 +1,216 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <errno.h>
+#include "trace.h"
+#include "logger.h"
+
+#define TRACE_MAGIC		"EQTRACE2"
+#define TRACE_MAGIC_V1	"EQTRACE1"
+
+static void write_varint(FILE *fp, uint64_t x);
+static bool read_varint(FILE *fp, uint64_t *res);
+static void write_u32(FILE *fp, uint32_t x);
+static uint32_t get_u32(const unsigned char *ptr);
+
+TraceWriter::TraceWriter()
+{
+	fp = 0;
+	prev_time = 0;
+}
+
+TraceWriter::~TraceWriter()
+{
+	close();
+}
+
+bool TraceWriter::open(const char *path, uint64_t start_time, int num_queues, int retention)
+{
+	close();
+
+	if(!(fp = fopen(path, "wb"))) {
+		log_error("failed to open trace file: %s: %s", path, strerror(errno));
+		return false;
+	}
+	fwrite(TRACE_MAGIC, 1, 8, fp);
+	write_u32(fp, start_time & 0xffffffff);
+	write_u32(fp, start_time >> 32);
+	write_u32(fp, num_queues);
+	write_u32(fp, retention);
+	prev_time = start_time;
+	return true;
+}
+
+void TraceWriter::close()
+{
+	if(fp) {
+		fclose(fp);
+		fp = 0;
+	}
+}
+
+void TraceWriter::write(int dir, uint64_t time, const void *data, int len)
+{
+	if(!fp || len <= 0) return;
+
+	/* the cached loop time might lag behind the last record by a bit */
+	uint64_t dt = time > prev_time ? time - prev_time : 0;
+	prev_time += dt;
+
+	fputc(dir, fp);
+	write_varint(fp, dt);
+	write_varint(fp, len);
+	fwrite(data, 1, len, fp);
+}
+
+TraceReader::TraceReader()
+{
+	fp = 0;
+	start_time = prev_time = 0;
+	num_queues = 1;
+	retention = 0;
+}
+
+TraceReader::~TraceReader()
+{
+	close();
+}
+
+bool TraceReader::open(const char *path)
+{
+	unsigned char hdr[24];
+
+	close();
+
+	if(!(fp = fopen(path, "rb"))) {
+		log_error("failed to open trace file: %s: %s", path, strerror(errno));
+		return false;
+	}
+
+	bool v1 = false;
+	if(fread(hdr, 1, 16, fp) < 16 || (memcmp(hdr, TRACE_MAGIC, 8) != 0 &&
+				!(v1 = memcmp(hdr, TRACE_MAGIC_V1, 8) == 0))) {
+		log_error("%s is not a trace file", path);
+		close();
+		return false;
+	}
+	start_time = get_u32(hdr + 8) | ((uint64_t)get_u32(hdr + 12) << 32);
+	prev_time = start_time;
+
+	num_queues = 1;
+	retention = 0;
+	if(!v1) {
+		if(fread(hdr + 16, 1, 8, fp) < 8) {
+			log_error("%s: truncated trace header", path);
+			close();
+			return false;
+		}
+		num_queues = get_u32(hdr + 16);
+		retention = get_u32(hdr + 20);
+	}
+	return true;
+}
+
+void TraceReader::close()
+{
+	if(fp) {
+		fclose(fp);
+		fp = 0;
+	}
+}
+
+uint64_t TraceReader::get_start_time() const
+{
+	return start_time;
+}
+
+int TraceReader::get_num_queues() const
+{
+	return num_queues;
+}
+
+int TraceReader::get_retention() const
+{
+	return retention;
+}
+
+bool TraceReader::read(TraceRec *rec)
+{
+	uint64_t dt, len;
+	int dir;
+
+	if(!fp || (dir = fgetc(fp)) == EOF) {
+		return false;
+	}
+	if(!read_varint(fp, &dt) || !read_varint(fp, &len) || len > 65536) {
+		log_warning("truncated or corrupt trace record");
+		return false;
+	}
+
+	rec->dir = dir;
+	rec->time = prev_time += dt;
+	rec->data.resize(len);
+	if(len && fread(&rec->data[0], 1, len, fp) < len) {
+		log_warning("truncated trace record");
+		return false;
+	}
+	return true;
+}
+
+/* LEB128: 7 bits per byte, least significant first, top bit set on all but
+ * the last byte.
+ */
+static void write_varint(FILE *fp, uint64_t x)
+{
+	while(x >= 0x80) {
+		fputc((x & 0x7f) | 0x80, fp);
+		x >>= 7;
+	}
+	fputc(x, fp);
+}
+
+static bool read_varint(FILE *fp, uint64_t *res)
+{
+	uint64_t x = 0;
+	int c;
+
+	for(int shift=0; shift<64; shift+=7) {
+		if((c = fgetc(fp)) == EOF) {
+			return false;
+		}
+		x |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80)) {
+			*res = x;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void write_u32(FILE *fp, uint32_t x)
+{
+	for(int i=0; i<4; i++) {
+		fputc((x >> (i * 8)) & 0xff, fp);
+	}
+}
+
+static uint32_t get_u32(const unsigned char *ptr)
+{
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
@@ -0,0 +1,83 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string>
+
+/* Serial session traces: every chunk of bytes read from, or written to a
+ * device port, with the (monotonic) time it was handled.
+ *
+ * file format: 8 byte magic, u64 start time in usec, u32 number of queues
+ * and u32 retention of the recording device (0 for the default), all
+ * little-endian, then for every chunk: u8 direction, varint usec since the
+ * previous chunk (or the start), varint length, and the bytes themselves.
+ * Version 1 traces lack the queue count and retention, which were 1 and the
+ * default back then.
+ */
+enum {
+	TRACE_IN = 1,		/* host to device */
+	TRACE_OUT = 2		/* device to host */
+};
+
+struct TraceRec {
+	int dir;
+	uint64_t time;		/* usec */
+	std::string data;
+};
+
+class TraceWriter {
+private:
+	FILE *fp;
+	uint64_t prev_time;
+
+public:
+	TraceWriter();
+	~TraceWriter();
+
+	bool open(const char *path, uint64_t start_time, int num_queues, int retention);
+	void close();
+
+	void write(int dir, uint64_t time, const void *data, int len);
+};
+
+class TraceReader {
+private:
+	FILE *fp;
+	uint64_t start_time, prev_time;
+	int num_queues, retention;
+
+public:
+	TraceReader();
+	~TraceReader();
+
+	bool open(const char *path);
+	void close();
+
+	uint64_t get_start_time() const;
+	/* configuration of the recording device */
+	int get_num_queues() const;
+	int get_retention() const;
+	/* returns false at the end of the trace (or if it's truncated) */
+	bool read(TraceRec *rec);
+};
+
+#endif	/* TRACE_H_ */
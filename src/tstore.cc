@@ -0,0 +1,125 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "tstore.h"
+
+#define DEF_RETENTION	1024
+
+static int next_pow2(int x);
+
+TicketStore::TicketStore()
+{
+	ring = 0;
+	size = mask = 0;
+	retention = DEF_RETENTION;
+	last_id = 0;
+}
+
+TicketStore::~TicketStore()
+{
+	delete [] ring;
+}
+
+void TicketStore::set_retention(int count)
+{
+	if(count < 1) count = 1;
+	retention = count;
+
+	if(ring && next_pow2(retention) > size) {
+		resize(next_pow2(retention));
+	}
+}
+
+int TicketStore::get_retention() const
+{
+	return retention;
+}
+
+int TicketStore::get_capacity() const
+{
+	return size;
+}
+
+CustStat *TicketStore::add(int id, long start)
+{
+	if(!ring) {
+		resize(next_pow2(retention));
+	}
+
+	CustStat *st = ring + (id & mask);
+	if(st->id > 0 && st->id != id && st->end == -1) {
+		/* the slot is taken by a customer who's still waiting */
+		resize(size * 2);
+		st = ring + (id & mask);
+	}
+
+	st->id = id;
+	st->start = start;
+	st->end = -1;
+	last_id = id;
+	return st;
+}
+
+CustStat *TicketStore::find(int id)
+{
+	if(!ring || id <= 0) return 0;
+
+	CustStat *st = ring + (id & mask);
+	return st->id == id ? st : 0;
+}
+
+void TicketStore::clear()
+{
+	if(ring) {
+		memset(ring, 0, size * sizeof *ring);
+	}
+	last_id = 0;
+}
+
+void TicketStore::resize(int nsize)
+{
+	CustStat *nring = new CustStat[nsize];
+	memset(nring, 0, nsize * sizeof *nring);
+	int nmask = nsize - 1;
+
+	/* carry over the most recent entries that fit in the new ring */
+	for(int i=0; i<size; i++) {
+		CustStat *st = ring + i;
+		if(st->id > 0 && st->id > last_id - nsize) {
+			nring[st->id & nmask] = *st;
+		}
+	}
+
+	delete [] ring;
+	ring = nring;
+	size = nsize;
+	mask = nmask;
+}
+
+static int next_pow2(int x)
+{
+	x--;
+	x = (x >> 1) | x;
+	x = (x >> 2) | x;
+	x = (x >> 4) | x;
+	x = (x >> 8) | x;
+	x = (x >> 16) | x;
+	return x + 1;
+}
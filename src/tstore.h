@@ -0,0 +1,55 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TSTORE_H_
+#define TSTORE_H_
+
+struct CustStat {
+	int id;
+	long start, end;	/* usec, end is -1 while the customer is waiting */
+};
+
+/* Customer statistics store, indexed by ticket id. Since ticket ids are
+ * issued sequentially, entries live in a power-of-two ring at id & mask, so
+ * both adding a ticket and looking one up are constant time. Completed
+ * entries older than the retention window are overwritten; tickets still
+ * waiting are never evicted, the ring grows instead if that many are queued.
+ */
+class TicketStore {
+private:
+	CustStat *ring;
+	int size, mask;
+	int retention;
+	int last_id;
+
+	void resize(int nsize);
+
+public:
+	TicketStore();
+	~TicketStore();
+
+	void set_retention(int count);
+	int get_retention() const;
+	int get_capacity() const;
+
+	CustStat *add(int id, long start);
+	CustStat *find(int id);
+	void clear();
+};
+
+#endif	/* TSTORE_H_ */
@@ -0,0 +1,146 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <math.h>
+#include "waitstat.h"
+
+static inline int bucket_index(uint64_t val);
+static inline uint64_t bucket_value(int idx);
+
+WaitStats::WaitStats()
+{
+	reset();
+}
+
+void WaitStats::reset()
+{
+	count = sum = 0;
+	min = max = 0;
+	memset(hist, 0, sizeof hist);
+}
+
+void WaitStats::add(uint64_t val)
+{
+	if(!count || val < min) min = val;
+	if(!count || val > max) max = val;
+	count++;
+	sum += val;
+	hist[bucket_index(val)]++;
+}
+
+void WaitStats::merge(const WaitStats &ws)
+{
+	if(!ws.count) return;
+
+	if(!count || ws.min < min) min = ws.min;
+	if(!count || ws.max > max) max = ws.max;
+	count += ws.count;
+	sum += ws.sum;
+
+	for(int i=0; i<WSTAT_NUM_BUCKETS; i++) {
+		hist[i] += ws.hist[i];
+	}
+}
+
+uint64_t WaitStats::get_count() const
+{
+	return count;
+}
+
+double WaitStats::get_mean() const
+{
+	return count ? (double)sum / (double)count : 0.0;
+}
+
+uint64_t WaitStats::get_min() const
+{
+	return min;
+}
+
+uint64_t WaitStats::get_max() const
+{
+	return max;
+}
+
+uint64_t WaitStats::get_percentile(double p) const
+{
+	if(!count) return 0;
+	if(p <= 0.0) return min;
+	if(p >= 100.0) return max;
+
+	uint64_t rank = (uint64_t)ceil(p / 100.0 * (double)count);
+	uint64_t acc = 0;
+
+	for(int i=0; i<WSTAT_NUM_BUCKETS; i++) {
+		acc += hist[i];
+		if(acc >= rank) {
+			uint64_t val = bucket_value(i);
+			return val < min ? min : (val > max ? max : val);
+		}
+	}
+	return max;
+}
+
+bool WaitStats::write(FILE *fp) const
+{
+	uint64_t vals[] = {count, sum, min, max};
+	return fwrite(vals, sizeof vals, 1, fp) == 1 && fwrite(hist, sizeof hist, 1, fp) == 1;
+}
+
+bool WaitStats::read(FILE *fp)
+{
+	uint64_t vals[4];
+	if(fread(vals, sizeof vals, 1, fp) != 1 || fread(hist, sizeof hist, 1, fp) != 1) {
+		reset();
+		return false;
+	}
+	count = vals[0];
+	sum = vals[1];
+	min = vals[2];
+	max = vals[3];
+	return true;
+}
+
+/* values below 2 * WSTAT_SUB_COUNT are counted exactly. Above that, each power
+ * of two range is split into WSTAT_SUB_COUNT equal sub-buckets.
+ */
+static inline int bucket_index(uint64_t val)
+{
+	if(val < WSTAT_SUB_COUNT) {
+		return (int)val;
+	}
+	if(val >> WSTAT_MAX_BITS) {
+		return WSTAT_NUM_BUCKETS - 1;
+	}
+
+	int msb = 63 - __builtin_clzll(val);
+	int shift = msb - WSTAT_SUB_BITS;
+	return shift * WSTAT_SUB_COUNT + (int)(val >> shift);
+}
+
+/* middle of the range of values counted in a bucket */
+static inline uint64_t bucket_value(int idx)
+{
+	if(idx < 2 * WSTAT_SUB_COUNT) {
+		return idx;
+	}
+	int shift = idx / WSTAT_SUB_COUNT - 1;
+	uint64_t low = (uint64_t)(idx - shift * WSTAT_SUB_COUNT) << shift;
+	return low + ((uint64_t)1 << (shift - 1));
+}
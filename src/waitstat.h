@@ -0,0 +1,61 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef WAITSTAT_H_
+#define WAITSTAT_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define WSTAT_SUB_BITS		5
+#define WSTAT_SUB_COUNT		(1 << WSTAT_SUB_BITS)
+#define WSTAT_MAX_BITS		40		/* larger values are clamped */
+#define WSTAT_NUM_BUCKETS	((WSTAT_MAX_BITS - WSTAT_SUB_BITS + 1) * WSTAT_SUB_COUNT)
+
+/* Streaming wait time statistics. Keeps count, mean, min and max, and a
+ * log-linear (HDR-style) histogram with WSTAT_SUB_COUNT linear sub-buckets per
+ * power of two, which bounds the relative error of any percentile to about
+ * 1/WSTAT_SUB_COUNT in a fixed amount of memory. Histograms of the same
+ * layout can be merged, for instance to combine several devices.
+ */
+class WaitStats {
+private:
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min, max;
+	uint64_t hist[WSTAT_NUM_BUCKETS];
+
+public:
+	WaitStats();
+
+	void reset();
+	void add(uint64_t val);
+	void merge(const WaitStats &ws);
+
+	uint64_t get_count() const;
+	double get_mean() const;
+	uint64_t get_min() const;
+	uint64_t get_max() const;
+	/* p in [0, 100] */
+	uint64_t get_percentile(double p) const;
+
+	bool write(FILE *fp) const;
+	bool read(FILE *fp);
+};
+
+#endif	/* WAITSTAT_H_ */
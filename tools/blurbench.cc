@@ -0,0 +1,259 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* blurbench - checks and benchmarks the fast_blur kernels.
+ * Blurs the same random images with every instruction set the CPU supports,
+ * checks that the results are identical to the scalar code, and reports how
+ * long each one takes per blur. With -t, also checks and times the blur
+ * split across a thread pool.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "fblur.h"
+#include "threadpool.h"
+#include "timer.h"
+#include "toolutil.h"
+
+static const char *isa_names[] = { "scalar", "sse2", "avx2" };
+
+static bool check(int xsz, int ysz, int amount, int isa, bool threaded, uint64_t *rng);
+static double bench(int xsz, int ysz, int amount, int isa, bool threaded);
+static void rand_image(uint32_t *img, int npix, uint64_t *rng);
+static uint32_t rand_u32(uint64_t *rng);
+static bool parse_list(const char *str, std::vector<int> *res);
+static int proc_args(int argc, char **argv);
+
+static int width = 640, height = 360;
+static std::vector<int> amounts;
+static int num_iter = 100;
+static int num_checks = 500;
+static int num_threads = 1;
+static ThreadPool pool;
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+	if(amounts.empty()) {
+		amounts.push_back(3);
+		amounts.push_back(5);
+		amounts.push_back(9);
+	}
+
+	if(num_threads != 1 && !pool.start(num_threads)) {
+		return 1;
+	}
+	num_threads = pool.get_num_threads();
+
+	int max_isa = fast_blur_use_isa(FBLUR_ISA_AVX2);
+	uint64_t rng = 0x9e3779b97f4a7c15ull;
+	bool ok = true;
+
+	/* random sizes, including odd ones which leave lines for the scalar code */
+	for(int isa=FBLUR_ISA_SSE2; isa<=max_isa; isa++) {
+		int i;
+		for(i=0; i<num_checks; i++) {
+			int amount = 2 + rand_u32(&rng) % 40;
+			int xsz = amount / 2 + 1 + rand_u32(&rng) % 100;
+			int ysz = amount / 2 + 1 + rand_u32(&rng) % 100;
+			if(!check(xsz, ysz, amount, isa, false, &rng)) {
+				ok = false;
+				break;
+			}
+		}
+		if(i == num_checks) {
+			printf("%s: %d random images identical to scalar\n", isa_names[isa], num_checks);
+		}
+	}
+
+	/* large enough to be split into bands, and odd sizes for partial bands */
+	if(num_threads > 1) {
+		int i, nimg = num_checks / 10;
+		for(i=0; i<nimg; i++) {
+			int amount = 2 + rand_u32(&rng) % 40;
+			int xsz = 200 + rand_u32(&rng) % 400;
+			int ysz = 200 + rand_u32(&rng) % 400;
+			if(!check(xsz, ysz, amount, max_isa, true, &rng)) {
+				ok = false;
+				break;
+			}
+		}
+		if(i == nimg) {
+			printf("%s, %d threads: %d random images identical to scalar\n", isa_names[max_isa],
+					num_threads, nimg);
+		}
+	}
+
+	printf("%dx%d, %d iterations\n", width, height, num_iter);
+	for(size_t i=0; i<amounts.size(); i++) {
+		int amount = amounts[i];
+		if(!check(width, height, amount, max_isa, num_threads > 1, &rng)) {
+			ok = false;
+		}
+
+		double scalar_msec = bench(width, height, amount, FBLUR_ISA_SCALAR, false);
+		printf("  blur %3d: scalar %.3f ms", amount, scalar_msec);
+		for(int isa=FBLUR_ISA_SSE2; isa<=max_isa; isa++) {
+			double msec = bench(width, height, amount, isa, false);
+			printf(", %s %.3f ms (%.1fx)", isa_names[isa], msec, scalar_msec / msec);
+		}
+		if(num_threads > 1) {
+			double msec = bench(width, height, amount, max_isa, true);
+			printf(", %d threads %.3f ms (%.1fx)", num_threads, msec, scalar_msec / msec);
+		}
+		putchar('\n');
+	}
+
+	fast_blur_use_isa(FBLUR_ISA_AVX2);
+	return ok ? 0 : 1;
+}
+
+static bool check(int xsz, int ysz, int amount, int isa, bool threaded, uint64_t *rng)
+{
+	int npix = xsz * ysz;
+	std::vector<uint32_t> ref(npix), img(npix);
+
+	rand_image(&ref[0], npix, rng);
+	img = ref;
+
+	fast_blur_use_isa(FBLUR_ISA_SCALAR);
+	fast_blur_use_pool(0);
+	fast_blur(BLUR_BOTH, amount, &ref[0], xsz, ysz);
+	fast_blur_use_isa(isa);
+	fast_blur_use_pool(threaded ? &pool : 0);
+	fast_blur(BLUR_BOTH, amount, &img[0], xsz, ysz);
+	fast_blur_use_pool(0);
+
+	for(int i=0; i<npix; i++) {
+		if(img[i] != ref[i]) {
+			printf("FAIL: %s%s blur %d of %dx%d differs at %d,%d: %08x instead of %08x\n",
+					isa_names[isa], threaded ? " threaded" : "", amount, xsz, ysz, i % xsz, i / xsz, img[i], ref[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* msec per BLUR_BOTH */
+static double bench(int xsz, int ysz, int amount, int isa, bool threaded)
+{
+	uint64_t rng = 1;
+	std::vector<uint32_t> img(xsz * ysz);
+	rand_image(&img[0], xsz * ysz, &rng);
+
+	fast_blur_use_isa(isa);
+	fast_blur_use_pool(threaded ? &pool : 0);
+	uint64_t start = get_time_nsec();
+	for(int i=0; i<num_iter; i++) {
+		fast_blur(BLUR_BOTH, amount, &img[0], xsz, ysz);
+	}
+	fast_blur_use_pool(0);
+	return (get_time_nsec() - start) / 1000000.0 / num_iter;
+}
+
+static void rand_image(uint32_t *img, int npix, uint64_t *rng)
+{
+	for(int i=0; i<npix; i++) {
+		img[i] = rand_u32(rng);
+	}
+}
+
+static uint32_t rand_u32(uint64_t *rng)
+{
+	return (uint32_t)(rand_next(rng) >> 32);
+}
+
+static bool parse_list(const char *str, std::vector<int> *res)
+{
+	char *endp;
+
+	res->clear();
+	for(;;) {
+		long val = strtol(str, &endp, 10);
+		if(endp == str || val < 2) {
+			return false;
+		}
+		res->push_back(val);
+
+		if(!*endp) break;
+		if(*endp != ',') {
+			return false;
+		}
+		str = endp + 1;
+	}
+	return true;
+}
+
+static const char *usage_fmt = "usage: %s [options]\n"
+	"options:\n"
+	"  -s <WxH>      image size to benchmark (default: 640x360)\n"
+	"  -b <list>     comma-separated blur sizes (default: 3,5,9)\n"
+	"  -n <count>    blurs to time per measurement (default: 100)\n"
+	"  -c <count>    random images to check per instruction set (default: 500)\n"
+	"  -t <threads>  also check and time the blur on this many threads,\n"
+	"                0 for one per processor (default: 1)\n"
+	"  -h            print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	for(int i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-h") == 0) {
+			printf(usage_fmt, argv[0]);
+			exit(0);
+
+		} else if(strcmp(argv[i], "-s") == 0) {
+			if(++i >= argc || sscanf(argv[i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1) {
+				fprintf(stderr, "-s must be followed by the image size, e.g. 640x360\n");
+				return -1;
+			}
+
+		} else if(strcmp(argv[i], "-b") == 0) {
+			if(++i >= argc || !parse_list(argv[i], &amounts)) {
+				fprintf(stderr, "-b must be followed by a list of blur sizes, at least 2\n");
+				return -1;
+			}
+
+		} else if(strcmp(argv[i], "-n") == 0) {
+			if(++i >= argc || (num_iter = atoi(argv[i])) <= 0) {
+				fprintf(stderr, "-n must be followed by the number of blurs\n");
+				return -1;
+			}
+
+		} else if(strcmp(argv[i], "-c") == 0) {
+			if(++i >= argc || (num_checks = atoi(argv[i])) < 0) {
+				fprintf(stderr, "-c must be followed by the number of images\n");
+				return -1;
+			}
+
+		} else if(strcmp(argv[i], "-t") == 0) {
+			if(++i >= argc || (num_threads = atoi(argv[i])) < 0) {
+				fprintf(stderr, "-t must be followed by the number of threads\n");
+				return -1;
+			}
+
+		} else {
+			fprintf(stderr, "invalid option: %s\n", argv[i]);
+			fprintf(stderr, usage_fmt, argv[0]);
+			return -1;
+		}
+	}
+	return 0;
+}
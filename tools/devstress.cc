@@ -0,0 +1,487 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* devstress - stress test and throughput benchmark of the device input path.
+ * Feeds millions of random commands to an in-process device, through its
+ * in-memory transport (Device::feed and output_func) instead of a serial
+ * port. The input is split at random points, mixes LF, CR and CRLF line
+ * terminators, and has our own response lines echoed back in between, like a
+ * loopback or a chatty host would. The responses are checked against a model
+ * of the device, and the command rate is reported, so that both regressions
+ * in the parser and slowdowns of the hot path show up. Switching to the binary
+ * protocol and back is checked first, with every way of splitting the input.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "dev.h"
+#include "timer.h"
+#include "logger.h"
+#include "toolutil.h"
+
+#define BATCH_SIZE	65536
+
+/* reference model of the queue state, and generator of the input */
+struct Model {
+	std::vector<int> ticket, customer;
+	uint64_t rng;
+
+	std::string input, expected;
+	long num_cmds, num_echo;
+};
+
+static bool check_protocol_switch();
+static std::string req_frame(unsigned long id, const char *cmd);
+static std::string resp_frame(unsigned long id, int status, const char *msg);
+static void gen_batch(Model *m, int count);
+static void gen_command(Model *m, std::string *cmd, std::string *resp);
+static void add_line(Model *m, const std::string &line);
+static int rand_int(uint64_t *rng, int range);
+static int rand_split(uint64_t *rng);
+static int proc_args(int argc, char **argv);
+
+static long num_commands = 1000000;
+static int num_queues = 4;
+static unsigned long seed = 1;
+static int max_split = LINEBUF_SIZE * 2;	/* 0: feed whole batches */
+static double min_rate;
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	if(!check_protocol_switch()) {
+		return 1;
+	}
+
+	Device dev;
+	if(!dev.set_num_queues(num_queues)) {
+		return 1;
+	}
+	std::string actual;
+	dev.output_func = collect_output;
+	dev.output_cls = &actual;
+
+	/* a fixed virtual clock keeps every wait time at 0, so the responses
+	 * don't depend on how fast we run
+	 */
+	set_now(1000000);
+
+	Model m;
+	m.ticket.resize(num_queues);
+	m.customer.resize(num_queues);
+	m.rng = seed * 0x9e3779b97f4a7c15ull;
+	if(!m.rng) m.rng = 1;
+	m.num_cmds = m.num_echo = 0;
+
+	uint64_t rng = m.rng ^ 0x2545f4914f6cdd1dull;
+	uint64_t busy = 0;
+	unsigned long bytes_in = 0, bytes_out = 0;
+	long nfeeds = 0;
+
+	for(long batch=0; m.num_cmds < num_commands; batch++) {
+		long left = num_commands - m.num_cmds;
+		gen_batch(&m, left < BATCH_SIZE ? left : BATCH_SIZE);
+		actual.clear();
+
+		const char *ptr = m.input.data();
+		const char *end = ptr + m.input.size();
+
+		uint64_t start = get_time_nsec();
+		while(ptr < end) {
+			int len = max_split > 0 ? rand_split(&rng) : (int)(end - ptr);
+			if(len > end - ptr) {
+				len = end - ptr;
+			}
+			/* the device stops taking input while its output is backlogged */
+			int consumed = 0;
+			while(consumed < len || dev.is_input_stalled()) {
+				consumed += dev.feed(ptr + consumed, len - consumed);
+				dev.flush();
+			}
+			ptr += len;
+			nfeeds++;
+		}
+		dev.flush();
+		busy += get_time_nsec() - start;
+
+		if(actual != m.expected) {
+			printf("FAIL: batch %ld\n", batch);
+			print_diff(m.expected, actual, "expected", "got");
+			return 1;
+		}
+		bytes_in += m.input.size();
+		bytes_out += actual.size();
+	}
+
+	for(int i=0; i<num_queues; i++) {
+		if(dev.get_ticket(i) != m.ticket[i] || dev.get_customer(i) != m.customer[i]) {
+			printf("FAIL: queue %d ended at ticket %d customer %d, expected %d and %d\n", i,
+					dev.get_ticket(i), dev.get_customer(i), m.ticket[i], m.customer[i]);
+			return 1;
+		}
+	}
+
+	double sec = busy / 1000000000.0;
+	double rate = sec > 0.0 ? m.num_cmds / sec : 0.0;
+
+	printf("%ld commands and %ld echoed lines in %ld reads (%lu bytes in, %lu out): OK\n",
+			m.num_cmds, m.num_echo, nfeeds, bytes_in, bytes_out);
+	printf("%.3f sec, %.0f commands/sec, %.1f MB/sec in\n", sec, rate,
+			sec > 0.0 ? bytes_in / sec / 1048576.0 : 0.0);
+
+	if(min_rate > 0.0 && rate < min_rate) {
+		printf("FAIL: command rate below %.0f/sec\n", min_rate);
+		return 1;
+	}
+	return 0;
+}
+
+/* switches to the binary protocol and back, with every line terminator, and
+ * the input split into three reads at every possible pair of points. Among
+ * others this splits a b1 CRLF between the CR and the LF, which must not leave
+ * the LF in front of the first frame.
+ */
+static bool check_protocol_switch()
+{
+	static const char *term[] = { "\n", "\r\n", "\r" };
+	std::string actual;
+	int count = 0;
+
+	std::string expected = "OK,switching to binary protocol\n";
+	expected += resp_frame(1, BIN_STATUS_OK, "Queue system emulator v0.1");
+	expected += resp_frame(2, BIN_STATUS_OK, "switching to text protocol");
+	expected += "OK,Queue system emulator v0.1\n";
+
+	for(int i=0; i<3; i++) {
+		std::string input = std::string("b1") + term[i] + req_frame(1, "v") +
+			req_frame(2, "b0") + "v\n";
+		int len = input.size();
+
+		for(int a=0; a<=len; a++) {
+			for(int b=a; b<=len; b++) {
+				Device dev;
+				dev.output_func = collect_output;
+				dev.output_cls = &actual;
+				actual.clear();
+
+				int split[] = { 0, a, b, len };
+				for(int j=0; j<3; j++) {
+					dev.feed(input.data() + split[j], split[j + 1] - split[j]);
+					dev.flush();
+				}
+
+				if(actual != expected) {
+					printf("FAIL: protocol switch with reads split at %d and %d\n", a, b);
+					print_diff(expected, actual, "expected", "got");
+					return false;
+				}
+				count++;
+			}
+		}
+	}
+	printf("protocol switch: %d ways of splitting the input OK\n", count);
+	return true;
+}
+
+static std::string req_frame(unsigned long id, const char *cmd)
+{
+	std::string frame;
+	int len = BIN_REQ_HDR_SIZE - 2 + strlen(cmd);
+
+	frame += (char)(len & 0xff);
+	frame += (char)(len >> 8);
+	for(int i=0; i<4; i++) {
+		frame += (char)((id >> (i * 8)) & 0xff);
+	}
+	return frame + cmd;
+}
+
+static std::string resp_frame(unsigned long id, int status, const char *msg)
+{
+	std::string frame;
+	int len = BIN_RESP_HDR_SIZE - 2 + strlen(msg);
+
+	frame += (char)(len & 0xff);
+	frame += (char)(len >> 8);
+	for(int i=0; i<4; i++) {
+		frame += (char)((id >> (i * 8)) & 0xff);
+	}
+	frame += (char)status;
+	return frame + msg;
+}
+
+static void gen_batch(Model *m, int count)
+{
+	std::string cmd, resp;
+
+	m->input.clear();
+	m->expected.clear();
+
+	for(int i=0; i<count; i++) {
+		gen_command(m, &cmd, &resp);
+		add_line(m, cmd);
+		m->expected += resp;
+		m->num_cmds++;
+
+		/* sometimes the host sends our responses right back at us */
+		if(rand_int(&m->rng, 4) == 0) {
+			size_t len = resp.size();
+			while(len > 0 && (resp[len - 1] == '\n' || resp[len - 1] == '\r')) {
+				len--;
+			}
+			add_line(m, resp.substr(0, len));
+			m->num_echo++;
+		}
+
+		switch(rand_int(&m->rng, 1000)) {
+		case 0:
+			/* empty lines are ignored */
+			add_line(m, "");
+			break;
+
+		case 1:
+			/* lines which don't fit in the input buffer are dropped whole */
+			add_line(m, std::string(LINEBUF_SIZE + rand_int(&m->rng, LINEBUF_SIZE), 'x'));
+			break;
+		}
+	}
+}
+
+/* queue number argument and its text in responses, see QFMT in dev.cc */
+static int rand_queue(Model *m, std::string *arg, std::string *qstr)
+{
+	int q = rand_int(&m->rng, num_queues);
+	char buf[16];
+
+	switch(rand_int(&m->rng, 4)) {
+	case 0:
+		if(q == 0) {
+			arg->clear();
+			break;
+		}
+	case 1:
+		sprintf(buf, "%d", q);
+		*arg = buf;
+		break;
+
+	case 2:
+		/* leading zeros are fine */
+		sprintf(buf, "00%d", q);
+		*arg = buf;
+		break;
+
+	default:
+		arg->clear();
+		q = 0;
+	}
+
+	if(q) {
+		sprintf(buf, " %d", q);
+		*qstr = buf;
+	} else {
+		qstr->clear();
+	}
+	return q;
+}
+
+static void gen_command(Model *m, std::string *cmd, std::string *resp)
+{
+	static const char *unknown = "dfgjklmouwxyz";
+	static const char *junk[] = { " ", "  ", "\t", "x", "eset", "ueue 3", "?" };
+	std::string arg, qstr;
+	char buf[128];
+	int q;
+
+	int r = rand_int(&m->rng, 100);
+	if(r < 30) {
+		q = rand_queue(m, &arg, &qstr);
+		*cmd = "q" + arg;
+		*resp = "OK,issuing queue ticket\n";
+		m->ticket[q]++;
+
+	} else if(r < 55) {
+		q = rand_queue(m, &arg, &qstr);
+		*cmd = "n" + arg;
+		*resp = "OK,next customer\n";
+		if(m->customer[q] < m->ticket[q]) {
+			m->customer[q]++;
+		}
+
+	} else if(r < 70) {
+		q = rand_queue(m, &arg, &qstr);
+		*cmd = "t" + arg;
+		sprintf(buf, "OK,ticket%s: %d\r\n", qstr.c_str(), m->ticket[q]);
+		*resp = buf;
+
+	} else if(r < 85) {
+		q = rand_queue(m, &arg, &qstr);
+		*cmd = "c" + arg;
+		sprintf(buf, "OK,customer%s: %d\r\n", qstr.c_str(), m->customer[q]);
+		*resp = buf;
+
+	} else if(r < 90) {
+		q = rand_queue(m, &arg, &qstr);
+		*cmd = "a" + arg;
+		sprintf(buf, "OK,avg wait time%s: 0\r\n", qstr.c_str());
+		*resp = buf;
+
+	} else if(r < 93) {
+		*cmd = "v";
+		*resp = "OK,Queue system emulator v0.1\n";
+
+	} else if(r < 95) {
+		if(rand_int(&m->rng, 2)) {
+			*cmd = "r";
+			*resp = "OK,reseting queues\n";
+			for(int i=0; i<num_queues; i++) {
+				m->ticket[i] = m->customer[i] = 0;
+			}
+		} else {
+			q = rand_int(&m->rng, num_queues);
+			sprintf(buf, "r%d", q);
+			*cmd = buf;
+			sprintf(buf, "OK,reseting queue %d\n", q);
+			*resp = buf;
+			m->ticket[q] = m->customer[q] = 0;
+		}
+
+	} else if(r < 98) {
+		sprintf(buf, "%c%d", "qntca"[rand_int(&m->rng, 5)], num_queues + rand_int(&m->rng, 100));
+		*cmd = buf;
+		sprintf(buf, "ERR,invalid queue: %s\n", cmd->c_str() + 1);
+		*resp = buf;
+
+	} else {
+		int len = 1 + rand_int(&m->rng, 8);
+		cmd->clear();
+		for(int i=0; i<len; i++) {
+			*cmd += unknown[rand_int(&m->rng, strlen(unknown))];
+		}
+		*resp = "ERR,unknown command: " + *cmd + "\n";
+		return;
+	}
+
+	/* anything after the command letter and queue number is ignored, and
+	 * hosts written for a single queue send things like "q " or "reset"
+	 */
+	if(rand_int(&m->rng, 8) == 0) {
+		*cmd += junk[rand_int(&m->rng, sizeof junk / sizeof *junk)];
+	}
+}
+
+/* appends a line to the input, with a random terminator */
+static void add_line(Model *m, const std::string &line)
+{
+	static const char *term[] = { "\n", "\r\n", "\r" };
+
+	m->input += line;
+	m->input += term[rand_int(&m->rng, 3)];
+}
+
+/* in [0, range) */
+static int rand_int(uint64_t *rng, int range)
+{
+	return (int)((rand_next(rng) >> 33) % range);
+}
+
+/* read sizes: mostly tiny, to split lines and terminators as much as possible,
+ * sometimes up to max_split
+ */
+static int rand_split(uint64_t *rng)
+{
+	switch(rand_int(rng, 4)) {
+	case 0:
+	case 1:
+		return 1 + rand_int(rng, 4);
+	case 2:
+		return 1 + rand_int(rng, 64);
+	default:
+		return 1 + rand_int(rng, max_split);
+	}
+}
+
+static const char *usage_fmt = "usage: %s [options]\n"
+	"options:\n"
+	"  -n <count>     number of commands (default: 1000000)\n"
+	"  -queues <n>    number of queues of the device (default: 4)\n"
+	"  -seed <n>      random seed (default: 1)\n"
+	"  -split <max>   maximum size of a read, 0 feeds the input in %d command\n"
+	"                 batches, for raw throughput (default: %d)\n"
+	"  -rate <cmds>   fail if fewer commands per second are processed\n"
+	"  -v             log every command\n"
+	"  -h             print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-') {
+			if(strcmp(argv[i], "-h") == 0) {
+				printf(usage_fmt, argv[0], BATCH_SIZE, max_split);
+				exit(0);
+
+			} else if(strcmp(argv[i], "-v") == 0) {
+				log_level = LOG_DEBUG;
+
+			} else if(strcmp(argv[i], "-n") == 0) {
+				if(++i >= argc || (num_commands = atol(argv[i])) <= 0) {
+					fprintf(stderr, "-n must be followed by the number of commands\n");
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-queues") == 0) {
+				if(++i >= argc || (num_queues = atoi(argv[i])) <= 0 || num_queues > MAX_QUEUES) {
+					fprintf(stderr, "-queues must be followed by the number of queues (1-%d)\n", MAX_QUEUES);
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-seed") == 0) {
+				if(++i >= argc) {
+					fprintf(stderr, "-seed must be followed by a number\n");
+					return -1;
+				}
+				seed = strtoul(argv[i], 0, 0);
+
+			} else if(strcmp(argv[i], "-split") == 0) {
+				if(++i >= argc || (max_split = atoi(argv[i])) < 0) {
+					fprintf(stderr, "-split must be followed by the maximum read size\n");
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-rate") == 0) {
+				if(++i >= argc || (min_rate = atof(argv[i])) <= 0.0) {
+					fprintf(stderr, "-rate must be followed by the minimum commands/sec\n");
+					return -1;
+				}
+
+			} else {
+				fprintf(stderr, "invalid option: %s\n", argv[i]);
+				return -1;
+			}
+
+		} else {
+			fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,445 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* eqbench - serial protocol load generator and latency benchmark.
+ * Fires a configurable mix of commands at the emulated device, either one at
+ * a time or pipelined, optionally rate-limited, and reports the sustained
+ * command rate and the round-trip latency distribution of the responses.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <inttypes.h>
+
+#define RESP_TIMEOUT	2000000		/* usec */
+
+struct CmdMix {
+	char cmd;
+	int weight;
+};
+
+static bool select_protocol(int fd, bool bin);
+static void leave_binary(int fd);
+static void proc_response(uint64_t now, bool ok, unsigned long id);
+static bool parse_mix(const char *str);
+static char pick_cmd();
+static int proc_args(int argc, char **argv);
+static uint64_t get_usec();
+static void print_report(double elapsed);
+
+static const char *devpath;
+static long num_cmds = 10000;
+static double duration;			/* seconds, overrides num_cmds if set */
+static double rate;				/* commands per second, 0: as fast as possible */
+static int depth = 1;			/* maximum number of commands in flight */
+static bool binary;				/* use the length-prefixed binary protocol */
+
+static CmdMix mix[8];
+static int num_mix, mix_total;
+
+static long sent, completed, errors;
+static std::vector<uint32_t> latency;
+
+static std::vector<uint64_t> inflight;	/* send timestamps, FIFO ring */
+static int head, tail, num_inflight;
+static uint64_t last_resp;
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	int fd = open(devpath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(fd == -1) {
+		fprintf(stderr, "failed to open %s: %s\n", devpath, strerror(errno));
+		return 1;
+	}
+	if(isatty(fd)) {
+		struct termios term;
+		if(tcgetattr(fd, &term) != -1) {
+			cfmakeraw(&term);
+			tcsetattr(fd, TCSANOW, &term);
+		}
+		tcflush(fd, TCIOFLUSH);
+	}
+	if(!select_protocol(fd, binary)) {
+		return 1;
+	}
+
+	inflight.resize(depth);
+
+	char line[8192];	/* partial line, or partial frames in binary mode */
+	int line_len = 0;
+
+	if(duration <= 0.0) {
+		latency.reserve(num_cmds);
+	}
+
+	uint64_t start = get_usec();
+	uint64_t end = duration > 0.0 ? start + (uint64_t)(duration * 1000000.0) : 0;
+	uint64_t next_send = start;
+	last_resp = start;
+
+	for(;;) {
+		uint64_t now = get_usec();
+
+		bool more = end ? now < end : sent < num_cmds;
+		if(!more && !num_inflight) {
+			break;
+		}
+		if(num_inflight && now - last_resp > RESP_TIMEOUT) {
+			fprintf(stderr, "timed out waiting for a response (%d commands in flight)\n", num_inflight);
+			break;
+		}
+
+		/* send as many commands as the pipeline depth and rate allow */
+		char outbuf[4096];
+		int outlen = 0;
+		while(more && num_inflight < depth && now >= next_send && outlen < (int)sizeof outbuf - 8) {
+			if(binary) {
+				unsigned long id = sent + 1;
+				outbuf[outlen++] = 5;
+				outbuf[outlen++] = 0;
+				for(int i=0; i<4; i++) {
+					outbuf[outlen++] = (id >> (i * 8)) & 0xff;
+				}
+				outbuf[outlen++] = pick_cmd();
+			} else {
+				outbuf[outlen++] = pick_cmd();
+				outbuf[outlen++] = '\n';
+			}
+
+			if(!num_inflight) last_resp = now;
+			inflight[tail] = now;
+			tail = (tail + 1) % depth;
+			num_inflight++;
+			sent++;
+
+			if(rate > 0.0) {
+				next_send = start + (uint64_t)(sent * 1000000.0 / rate);
+			}
+			more = end ? now < end : sent < num_cmds;
+		}
+		if(outlen) {
+			int wrsz = 0;
+			while(wrsz < outlen) {
+				int res = write(fd, outbuf + wrsz, outlen - wrsz);
+				if(res == -1) {
+					if(errno == EAGAIN) {
+						struct pollfd pfd = {fd, POLLOUT, 0};
+						poll(&pfd, 1, 100);
+						continue;
+					}
+					perror("write failed");
+					return 1;
+				}
+				wrsz += res;
+			}
+		}
+
+		/* wait for responses, or until it's time to send the next command */
+		int timeout = 100;
+		if(more && num_inflight < depth) {
+			timeout = next_send > now ? (int)((next_send - now) / 1000) : 0;
+		}
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, timeout) <= 0) {
+			continue;
+		}
+
+		char buf[4096];
+		int rdsz = read(fd, buf, sizeof buf);
+		if(rdsz <= 0) {
+			if(rdsz == -1 && errno == EAGAIN) continue;
+			fprintf(stderr, "device closed\n");
+			break;
+		}
+		now = get_usec();
+
+		if(binary) {
+			/* response frames: u16 length, u32 request id, u8 status, message */
+			if(line_len + rdsz > (int)sizeof line) {
+				fprintf(stderr, "invalid response frame\n");
+				break;
+			}
+			memcpy(line + line_len, buf, rdsz);
+			line_len += rdsz;
+
+			unsigned char *ptr = (unsigned char*)line;
+			int left = line_len;
+			while(left >= 2 && left >= 2 + (ptr[0] | (ptr[1] << 8))) {
+				int len = ptr[0] | (ptr[1] << 8);
+				if(len >= 5 && ptr[6] != 2) {	/* skip input reports */
+					unsigned long id = ptr[2] | (ptr[3] << 8) | (ptr[4] << 16) |
+						((unsigned long)ptr[5] << 24);
+					proc_response(now, ptr[6] == 0, id);
+				}
+				ptr += len + 2;
+				left -= len + 2;
+			}
+			memmove(line, ptr, left);
+			line_len = left;
+			continue;
+		}
+
+		for(int i=0; i<rdsz; i++) {
+			if(buf[i] != '\n' && buf[i] != '\r') {
+				if(line_len < (int)sizeof line - 1) {
+					line[line_len++] = buf[i];
+				}
+				continue;
+			}
+			if(!line_len) continue;
+			line[line_len] = 0;
+			line_len = 0;
+
+			/* input reports and anything else that isn't a response is ignored */
+			bool ok = memcmp(line, "OK,", 3) == 0;
+			if(!ok && memcmp(line, "ERR,", 4) != 0) {
+				continue;
+			}
+			proc_response(now, ok, 0);
+		}
+	}
+
+	print_report((get_usec() - start) / 1000000.0);
+	if(binary) {
+		leave_binary(fd);
+	}
+	close(fd);
+	return completed == sent && !errors ? 0 : 1;
+}
+
+/* id is the binary protocol request id, or 0 in text mode */
+static void proc_response(uint64_t now, bool ok, unsigned long id)
+{
+	if(!num_inflight) {
+		fprintf(stderr, "unexpected response\n");
+		return;
+	}
+	if(!ok) errors++;
+
+	/* responses come back in order, so the oldest request is the one answered */
+	if(id && id != (unsigned long)(completed + 1)) {
+		fprintf(stderr, "response id mismatch: got %lu, expected %ld\n", id, completed + 1);
+		errors++;
+	}
+
+	latency.push_back((uint32_t)(now - inflight[head]));
+	head = (head + 1) % depth;
+	num_inflight--;
+	completed++;
+	last_resp = now;
+}
+
+/* the device may have been left in either mode. The request is sent as a
+ * text line either way: in binary mode it isn't a valid frame, and the device
+ * goes back to parsing text. The reply is always a text line.
+ */
+static bool select_protocol(int fd, bool bin)
+{
+	const char *reply = bin ? "OK,switching to binary protocol\n" : "OK,switching to text protocol\n";
+	int reply_len = strlen(reply);
+	char buf[256];
+	int len = 0;
+
+	if(write(fd, bin ? "b1\n" : "b0\n", 3) != 3) {
+		perror("failed to select the protocol");
+		return false;
+	}
+
+	/* read a byte at a time, so that we don't eat into the binary stream */
+	uint64_t start = get_usec();
+	while(get_usec() - start < RESP_TIMEOUT) {
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, 100) <= 0 || read(fd, buf + len, 1) != 1) {
+			continue;
+		}
+		if(buf[len++] != '\n') {
+			if(len >= (int)sizeof buf) len = 0;
+			continue;
+		}
+		if(len >= reply_len && memcmp(buf + len - reply_len, reply, reply_len) == 0) {
+			return true;
+		}
+		len = 0;
+	}
+	fprintf(stderr, "device did not switch to %s mode\n", bin ? "binary" : "text");
+	return false;
+}
+
+/* leaves the device in text mode for whoever comes next */
+static void leave_binary(int fd)
+{
+	static const unsigned char frame[] = { 6, 0, 0, 0, 0, 0, 'b', '0' };
+
+	if(write(fd, frame, sizeof frame) != (int)sizeof frame) {
+		perror("failed to switch the device back to text mode");
+	}
+}
+
+static void print_report(double elapsed)
+{
+	printf("commands sent: %ld, completed: %ld, errors: %ld\n", sent, completed, errors);
+	printf("elapsed: %.3f sec, throughput: %.1f commands/sec\n", elapsed,
+			elapsed > 0.0 ? completed / elapsed : 0.0);
+
+	if(latency.empty()) return;
+	std::sort(latency.begin(), latency.end());
+
+	size_t n = latency.size();
+	printf("latency (usec): min %u, p50 %u, p99 %u, p999 %u, max %u\n", latency[0],
+			latency[n * 50 / 100], latency[n * 99 / 100], latency[n * 999 / 1000],
+			latency[n - 1]);
+}
+
+static char pick_cmd()
+{
+	int r = rand() % mix_total;
+	for(int i=0; i<num_mix; i++) {
+		if(r < mix[i].weight) {
+			return mix[i].cmd;
+		}
+		r -= mix[i].weight;
+	}
+	return mix[0].cmd;
+}
+
+/* mix specification: comma-separated cmd=weight pairs, e.g. "q=1,n=1,t=4" */
+static bool parse_mix(const char *str)
+{
+	num_mix = mix_total = 0;
+
+	while(*str) {
+		char *endp;
+		if(!strchr("qntca", str[0]) || str[1] != '=' || num_mix >= (int)(sizeof mix / sizeof *mix)) {
+			return false;
+		}
+		mix[num_mix].cmd = str[0];
+		mix[num_mix].weight = strtol(str + 2, &endp, 10);
+		if(endp == str + 2 || mix[num_mix].weight < 0 || (*endp && *endp != ',')) {
+			return false;
+		}
+		mix_total += mix[num_mix++].weight;
+		str = *endp ? endp + 1 : endp;
+	}
+	return mix_total > 0;
+}
+
+static uint64_t get_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const char *usage_fmt = "usage: %s [options] <device>\n"
+	"options:\n"
+	"  -m <mix>     command mix as cmd=weight pairs (default: q=1,n=1,t=1,c=1,a=1)\n"
+	"  -n <count>   number of commands to send (default: 10000)\n"
+	"  -d <sec>     run for the specified number of seconds instead\n"
+	"  -r <rate>    limit the send rate in commands/sec (default: unlimited)\n"
+	"  -p <depth>   number of commands in flight (default: 1, one at a time)\n"
+	"  -b           use the binary protocol\n"
+	"  -h           print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	parse_mix("q=1,n=1,t=1,c=1,a=1");
+
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][1] && !argv[i][2]) {
+			char opt = argv[i][1];
+			if(opt == 'h') {
+				printf(usage_fmt, argv[0]);
+				exit(0);
+			}
+			if(opt == 'b') {
+				binary = true;
+				continue;
+			}
+			if(!strchr("mndrp", opt)) {
+				fprintf(stderr, "invalid option: %s\n", argv[i]);
+				return -1;
+			}
+			if(++i >= argc) {
+				fprintf(stderr, "-%c must be followed by a value\n", opt);
+				return -1;
+			}
+
+			switch(opt) {
+			case 'm':
+				if(!parse_mix(argv[i])) {
+					fprintf(stderr, "invalid command mix: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'n':
+				if((num_cmds = atol(argv[i])) <= 0) {
+					fprintf(stderr, "invalid command count: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'd':
+				if((duration = atof(argv[i])) <= 0.0) {
+					fprintf(stderr, "invalid duration: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'r':
+				if((rate = atof(argv[i])) < 0.0) {
+					fprintf(stderr, "invalid rate: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'p':
+				if((depth = atoi(argv[i])) <= 0) {
+					fprintf(stderr, "invalid pipeline depth: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+			}
+
+		} else {
+			if(devpath) {
+				fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+				return -1;
+			}
+			devpath = argv[i];
+		}
+	}
+
+	if(!devpath) {
+		fprintf(stderr, usage_fmt, argv[0]);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* eqmon - live monitor for the metrics an emulator publishes in shared memory
+ * with -metrics. Samples the counters periodically and prints their rates,
+ * without any interaction with the emulator itself.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "metrics.h"
+
+struct Sample {
+	Metrics hdr;
+	MetricsDev dev;		/* sum of the selected devices */
+};
+
+static Metrics *map_metrics(const char *name, size_t *size);
+static void take_sample(const Metrics *m, Sample *s);
+static void print_rates(const Sample *prev, const Sample *cur, double dt, bool header);
+static int proc_args(int argc, char **argv);
+
+static const char *shm_name;
+static double interval = 1.0;
+static int dev_idx = -1;		/* -1: all devices */
+static long num_samples;		/* 0: until interrupted */
+
+static const char *stage_names[] = { "glow", "read", "scene", "blur", "apply", "swap" };
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	size_t size;
+	Metrics *m = map_metrics(shm_name, &size);
+	if(!m) {
+		return 1;
+	}
+	if(dev_idx >= (int)m->num_devices) {
+		fprintf(stderr, "invalid device %d, the emulator has %d devices\n", dev_idx, (int)m->num_devices);
+		return 1;
+	}
+
+	Sample prev, cur;
+	take_sample(m, &prev);
+
+	for(long i=0; !num_samples || i<num_samples; i++) {
+		usleep((useconds_t)(interval * 1000000.0));
+
+		if(kill(m->pid, 0) == -1 && errno == ESRCH) {
+			fprintf(stderr, "the emulator (pid %u) is no longer running\n", m->pid);
+			return 1;
+		}
+
+		take_sample(m, &cur);
+		print_rates(&prev, &cur, interval, i % 20 == 0);
+		prev = cur;
+	}
+
+	munmap(m, size);
+	return 0;
+}
+
+static Metrics *map_metrics(const char *name, size_t *size)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd == -1) {
+		fprintf(stderr, "failed to open shared memory segment %s: %s\n", name, strerror(errno));
+		return 0;
+	}
+
+	Metrics hdr;
+	if(pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr || memcmp(hdr.magic, METRICS_MAGIC, 8) != 0) {
+		fprintf(stderr, "%s is not an emulator metrics segment\n", name);
+		close(fd);
+		return 0;
+	}
+	if(hdr.version != METRICS_VERSION || hdr.dev_size < sizeof(MetricsDev) ||
+			hdr.size < sizeof hdr + hdr.num_devices * hdr.dev_size) {
+		fprintf(stderr, "%s: unsupported metrics version %u (expected %d)\n", name,
+				hdr.version, METRICS_VERSION);
+		close(fd);
+		return 0;
+	}
+
+	void *map = mmap(0, hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "failed to map shared memory segment %s: %s\n", name, strerror(errno));
+		return 0;
+	}
+	*size = hdr.size;
+	return (Metrics*)map;
+}
+
+static void take_sample(const Metrics *m, Sample *s)
+{
+	s->hdr = *m;
+	memset(&s->dev, 0, sizeof s->dev);
+
+	for(int i=0; i<(int)m->num_devices; i++) {
+		if(dev_idx >= 0 && i != dev_idx) continue;
+
+		const MetricsDev *dev = (const MetricsDev*)((const char*)(m + 1) + i * m->dev_size);
+		for(int j=0; j<METRICS_NUM_CMDS; j++) {
+			s->dev.cmds[j] += dev->cmds[j];
+		}
+		s->dev.bytes_in += dev->bytes_in;
+		s->dev.bytes_out += dev->bytes_out;
+		s->dev.bytes_dropped += dev->bytes_dropped;
+		s->dev.tickets += dev->tickets;
+		s->dev.served += dev->served;
+		s->dev.queue_depth += dev->queue_depth;
+	}
+}
+
+#define RATE(field)		((cur->field - prev->field) / dt)
+
+static void print_rates(const Sample *prev, const Sample *cur, double dt, bool header)
+{
+	if(header) {
+		printf("  cmds/s   in B/s  out B/s drop B/s tckts/s srvd/s   queue |   fps frame ms:");
+		for(int i=0; i<NUM_FRAME_STAGES; i++) {
+			printf(" %6s", stage_names[i]);
+		}
+		putchar('\n');
+	}
+
+	uint64_t cmds = 0, prev_cmds = 0;
+	for(int i=0; i<METRICS_NUM_CMDS; i++) {
+		cmds += cur->dev.cmds[i];
+		prev_cmds += prev->dev.cmds[i];
+	}
+
+	printf("%8.1f %8.0f %8.0f %8.0f %7.1f %6.1f %7ld |", (cmds - prev_cmds) / dt,
+			RATE(dev.bytes_in), RATE(dev.bytes_out), RATE(dev.bytes_dropped),
+			RATE(dev.tickets), RATE(dev.served), (long)cur->dev.queue_depth);
+
+	uint64_t frames = cur->hdr.frames - prev->hdr.frames;
+	printf(" %5.1f", frames / dt);
+	if(frames) {
+		printf(" %8.2f", (cur->hdr.frame_usec - prev->hdr.frame_usec) / 1000.0 / frames);
+		for(int i=0; i<NUM_FRAME_STAGES; i++) {
+			printf(" %6.2f", (cur->hdr.stage_usec[i] - prev->hdr.stage_usec[i]) / 1000.0 / frames);
+		}
+	}
+	putchar('\n');
+
+	/* and the breakdown by command */
+	if(cmds != prev_cmds) {
+		printf("    ");
+		for(int i=0; i<METRICS_NUM_CMDS; i++) {
+			uint64_t n = cur->dev.cmds[i] - prev->dev.cmds[i];
+			if(n) {
+				printf(" %c:%.1f", i < 26 ? 'a' + i : '?', n / dt);
+			}
+		}
+		putchar('\n');
+	}
+	fflush(stdout);
+}
+
+static const char *usage_fmt = "usage: %s [options] <shm name>\n"
+	"options:\n"
+	"  -i <sec>     sampling interval (default: 1)\n"
+	"  -n <count>   exit after <count> samples (default: run until interrupted)\n"
+	"  -d <device>  show only the specified device (default: sum of all devices)\n"
+	"  -h           print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][1] && !argv[i][2]) {
+			char opt = argv[i][1];
+			if(opt == 'h') {
+				printf(usage_fmt, argv[0]);
+				exit(0);
+			}
+			if(!strchr("ind", opt)) {
+				fprintf(stderr, "invalid option: %s\n", argv[i]);
+				return -1;
+			}
+			if(++i >= argc) {
+				fprintf(stderr, "-%c must be followed by a value\n", opt);
+				return -1;
+			}
+
+			switch(opt) {
+			case 'i':
+				if((interval = atof(argv[i])) <= 0.0) {
+					fprintf(stderr, "invalid interval: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'n':
+				if((num_samples = atol(argv[i])) <= 0) {
+					fprintf(stderr, "invalid sample count: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+
+			case 'd':
+				if((dev_idx = atoi(argv[i])) < 0) {
+					fprintf(stderr, "invalid device: %s\n", argv[i]);
+					return -1;
+				}
+				break;
+			}
+
+		} else {
+			if(shm_name) {
+				fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+				return -1;
+			}
+			shm_name = argv[i];
+		}
+	}
+
+	if(!shm_name) {
+		fprintf(stderr, usage_fmt, argv[0]);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* eqreplay - replays a serial session recorded with -trace.
+ * Feeds the recorded input to an in-process device, running on a virtual
+ * clock set to the recorded time of every input chunk, so the device behaves
+ * exactly as it did live. Replays at the recorded pace, any multiple of it,
+ * or as fast as possible, and compares the responses to the recorded ones.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include "dev.h"
+#include "trace.h"
+#include "timer.h"
+#include "logger.h"
+#include "toolutil.h"
+
+static int proc_args(int argc, char **argv);
+
+static const char *trace_path;
+static double speed;		/* multiple of the recorded pace, 0: maximum */
+static int retention;		/* 0: as recorded */
+static int num_queues;		/* 0: as recorded */
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	TraceReader trace;
+	if(!trace.open(trace_path)) {
+		return 1;
+	}
+
+	/* configured like the recording device, unless overridden */
+	if(!num_queues) {
+		num_queues = trace.get_num_queues();
+	}
+	if(!retention) {
+		retention = trace.get_retention();
+	}
+	if(num_queues <= 0 || num_queues > MAX_QUEUES || retention < 0) {
+		fprintf(stderr, "%s: invalid device configuration: %d queues, retention %d\n",
+				trace_path, num_queues, retention);
+		return 1;
+	}
+
+	Device dev;
+	dev.set_num_queues(num_queues);
+	if(retention > 0) {
+		dev.set_retention(retention);
+	}
+	std::string expected, actual;
+	dev.output_func = collect_output;
+	dev.output_cls = &actual;
+
+	TraceRec rec;
+	long num_in = 0, num_out = 0;
+	unsigned long bytes_in = 0;
+	uint64_t trace_start = trace.get_start_time();
+	uint64_t trace_end = trace_start;
+	uint64_t start = get_time_usec();
+
+	while(trace.read(&rec)) {
+		trace_end = rec.time;
+
+		if(rec.dir == TRACE_OUT) {
+			expected += rec.data;
+			num_out++;
+			continue;
+		}
+		if(rec.dir != TRACE_IN) continue;
+
+		if(speed > 0.0) {
+			uint64_t due = start + (uint64_t)((rec.time - trace_start) / speed);
+			uint64_t now = get_time_usec();
+			if(due > now) {
+				usleep(due - now);
+			}
+		}
+
+		/* the device sees the time this input was handled when recording */
+		set_now(rec.time);
+
+		int len = rec.data.size();
+		int consumed = 0;
+		while(consumed < len || dev.is_input_stalled()) {
+			consumed += dev.feed(rec.data.data() + consumed, len - consumed);
+			dev.flush();
+		}
+
+		num_in++;
+		bytes_in += len;
+	}
+
+	double elapsed = (get_time_usec() - start) / 1000000.0;
+	double duration = (trace_end - trace_start) / 1000000.0;
+
+	printf("replayed %ld input chunks (%lu bytes), %ld output chunks recorded\n",
+			num_in, bytes_in, num_out);
+	printf("trace duration: %.3f sec, replay: %.3f sec (%.1fx)\n", duration, elapsed,
+			elapsed > 0.0 ? duration / elapsed : 0.0);
+
+	if(actual == expected) {
+		printf("responses match (%lu bytes)\n", (unsigned long)actual.size());
+		return 0;
+	}
+	print_diff(expected, actual, "recorded", "replayed");
+	return 1;
+}
+
+static const char *usage_fmt = "usage: %s [options] <trace file>\n"
+	"options:\n"
+	"  -s <speed>   replay at <speed> times the recorded pace (default: as fast\n"
+	"               as possible)\n"
+	"  -retain <n>  override the retention recorded in the trace\n"
+	"  -queues <n>  override the number of queues recorded in the trace\n"
+	"  -v           log every command replayed\n"
+	"  -h           print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	for(int i=1; i<argc; i++) {
+		if(argv[i][0] == '-') {
+			if(strcmp(argv[i], "-h") == 0) {
+				printf(usage_fmt, argv[0]);
+				exit(0);
+
+			} else if(strcmp(argv[i], "-v") == 0) {
+				log_level = LOG_DEBUG;
+
+			} else if(strcmp(argv[i], "-s") == 0) {
+				if(++i >= argc || (speed = atof(argv[i])) <= 0.0) {
+					fprintf(stderr, "-s must be followed by a speed multiplier\n");
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-queues") == 0) {
+				if(++i >= argc || (num_queues = atoi(argv[i])) <= 0 || num_queues > MAX_QUEUES) {
+					fprintf(stderr, "-queues must be followed by the number of queues (1-%d)\n", MAX_QUEUES);
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-retain") == 0) {
+				if(++i >= argc || (retention = atoi(argv[i])) <= 0) {
+					fprintf(stderr, "-retain must be followed by a ticket count\n");
+					return -1;
+				}
+
+			} else {
+				fprintf(stderr, "invalid option: %s\n", argv[i]);
+				return -1;
+			}
+
+		} else {
+			if(trace_path) {
+				fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+				return -1;
+			}
+			trace_path = argv[i];
+		}
+	}
+
+	if(!trace_path) {
+		fprintf(stderr, usage_fmt, argv[0]);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,389 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* eqsim - discrete-event simulation of a branch queue, for capacity planning.
+ * Drives the device ticket/customer state machine with random customer
+ * arrivals and service times on a virtual clock, so weeks of traffic take
+ * seconds, and reports the resulting wait time distributions. Every
+ * combination of the given counter counts, arrival rates and service times is
+ * a separate scenario, and scenarios run in parallel on a pool of threads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <queue>
+#include <pthread.h>
+#include <unistd.h>
+#include "dev.h"
+#include "timer.h"
+#include "toolutil.h"
+
+#define USEC_PER_MIN	60000000.0
+
+enum { DIST_EXP, DIST_FIXED, DIST_UNIFORM };
+
+struct Scenario {
+	int counters;
+	double arrival_rate;	/* customers per hour */
+	double service_mean;	/* minutes */
+	unsigned long seed;
+
+	/* results */
+	WaitStats wstat;
+	long served, max_queue;
+	double utilization;
+};
+
+struct Completion {
+	uint64_t time;
+	int counter;
+
+	bool operator <(const Completion &c) const { return time > c.time; }	/* min-heap */
+};
+
+static void run_scenario(Scenario *sc);
+static void *worker(void *cls);
+static double rand_dist(int dist, double mean, uint64_t *rng);
+static double rand_uniform(uint64_t *rng);
+static bool parse_list(const char *str, std::vector<double> *res);
+static void print_results();
+static bool write_dist(const char *fname);
+static int proc_args(int argc, char **argv);
+
+static std::vector<double> opt_counters, opt_rates, opt_service;
+static int arrival_dist = DIST_EXP, service_dist = DIST_EXP;
+static double duration = 24.0 * 7.0;	/* hours */
+static int num_reps = 1;
+static unsigned long seed = 1;
+static int num_threads;
+static const char *dist_fname;
+
+static std::vector<Scenario> scenarios;
+static int next_scenario;
+
+int main(int argc, char **argv)
+{
+	if(proc_args(argc, argv) == -1) {
+		return 1;
+	}
+
+	for(size_t i=0; i<opt_counters.size(); i++) {
+		for(size_t j=0; j<opt_rates.size(); j++) {
+			for(size_t k=0; k<opt_service.size(); k++) {
+				for(int r=0; r<num_reps; r++) {
+					Scenario sc;
+					sc.counters = (int)opt_counters[i];
+					sc.arrival_rate = opt_rates[j];
+					sc.service_mean = opt_service[k];
+					sc.seed = seed + r;
+					sc.served = sc.max_queue = 0;
+					sc.utilization = 0.0;
+					scenarios.push_back(sc);
+				}
+			}
+		}
+	}
+
+	if(num_threads <= 0) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(num_threads > (int)scenarios.size()) {
+		num_threads = scenarios.size();
+	}
+
+	uint64_t start = get_time_usec();
+
+	std::vector<pthread_t> threads(num_threads);
+	for(int i=0; i<num_threads; i++) {
+		if(pthread_create(&threads[i], 0, worker, 0) != 0) {
+			fprintf(stderr, "failed to create worker thread\n");
+			return 1;
+		}
+	}
+	for(int i=0; i<num_threads; i++) {
+		pthread_join(threads[i], 0);
+	}
+
+	double elapsed = (get_time_usec() - start) / 1000000.0;
+
+	print_results();
+	printf("simulated %d scenarios of %.1f hours in %.3f sec (%d threads)\n",
+			(int)scenarios.size(), duration, elapsed, num_threads);
+
+	if(dist_fname && !write_dist(dist_fname)) {
+		return 1;
+	}
+	return 0;
+}
+
+static void *worker(void *cls)
+{
+	for(;;) {
+		int idx = __atomic_fetch_add(&next_scenario, 1, __ATOMIC_RELAXED);
+		if(idx >= (int)scenarios.size()) {
+			break;
+		}
+		run_scenario(&scenarios[idx]);
+	}
+	return 0;
+}
+
+/* Customers take a ticket on arrival, and whenever a counter frees up, it
+ * calls the next customer (next_customer) and serves them for a random
+ * service time. The device measures the wait from the ticket to the call, on
+ * the virtual clock, exactly as it does live.
+ */
+static void run_scenario(Scenario *sc)
+{
+	Device *dev = new Device;
+	uint64_t rng = sc->seed * 0x9e3779b97f4a7c15ull + sc->counters * 7919 +
+		(uint64_t)(sc->arrival_rate * 1000.0) + (uint64_t)(sc->service_mean * 1000.0);
+	if(!rng) rng = 1;
+
+	double arrival_mean = 60.0 * USEC_PER_MIN / sc->arrival_rate;
+	double service_mean = sc->service_mean * USEC_PER_MIN;
+	uint64_t end = (uint64_t)(duration * 60.0 * USEC_PER_MIN);
+
+	std::priority_queue<Completion> busy;
+	std::vector<int> idle;
+	for(int i=0; i<sc->counters; i++) {
+		idle.push_back(i);
+	}
+
+	uint64_t busy_time = 0;
+	uint64_t next_arrival = (uint64_t)rand_dist(arrival_dist, arrival_mean, &rng);
+
+	for(;;) {
+		uint64_t now;
+		int counter = -1;
+
+		if(!busy.empty() && busy.top().time <= next_arrival) {
+			now = busy.top().time;
+			counter = busy.top().counter;
+			busy.pop();
+		} else {
+			now = next_arrival;
+		}
+		if(now >= end) break;
+
+		set_now(now);
+
+		if(counter >= 0) {
+			idle.push_back(counter);
+		} else {
+			dev->issue_ticket();
+			next_arrival = now + (uint64_t)rand_dist(arrival_dist, arrival_mean, &rng);
+
+			long qlen = dev->get_ticket() - dev->get_customer();
+			if(qlen > sc->max_queue) {
+				sc->max_queue = qlen;
+			}
+		}
+
+		while(!idle.empty() && dev->get_customer() < dev->get_ticket()) {
+			dev->next_customer();
+
+			Completion c;
+			uint64_t svc = (uint64_t)rand_dist(service_dist, service_mean, &rng);
+			c.time = now + svc;
+			c.counter = idle.back();
+			idle.pop_back();
+			busy.push(c);
+
+			busy_time += svc;
+		}
+	}
+
+	sc->wstat = dev->get_wait_stats();
+	sc->served = dev->get_customer();
+	sc->utilization = (double)busy_time / ((double)end * sc->counters);
+	delete dev;
+}
+
+static double rand_dist(int dist, double mean, uint64_t *rng)
+{
+	switch(dist) {
+	case DIST_FIXED:
+		return mean;
+	case DIST_UNIFORM:
+		return rand_uniform(rng) * 2.0 * mean;
+	case DIST_EXP:
+	default:
+		break;
+	}
+	return -log(1.0 - rand_uniform(rng)) * mean;
+}
+
+/* in [0, 1). Per scenario, so the results don't depend on the number of
+ * threads.
+ */
+static double rand_uniform(uint64_t *rng)
+{
+	return (rand_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#define MIN(x)	((double)(x) / USEC_PER_MIN)
+
+static void print_results()
+{
+	printf("counters arrivals/h service   seed   served  util  maxq |    mean     p50     p90     p99     max (wait, min)\n");
+	for(size_t i=0; i<scenarios.size(); i++) {
+		Scenario *sc = &scenarios[i];
+		const WaitStats &ws = sc->wstat;
+
+		printf("%8d %10.1f %7.2f %6lu %8ld %5.2f %5ld | %7.2f %7.2f %7.2f %7.2f %7.2f\n",
+				sc->counters, sc->arrival_rate, sc->service_mean, sc->seed, sc->served,
+				sc->utilization, sc->max_queue, MIN(ws.get_mean()), MIN(ws.get_percentile(50)),
+				MIN(ws.get_percentile(90)), MIN(ws.get_percentile(99)), MIN(ws.get_max()));
+	}
+}
+
+/* wait time distribution of every scenario, as CSV: one row per percentile */
+static bool write_dist(const char *fname)
+{
+	FILE *fp = fopen(fname, "w");
+	if(!fp) {
+		perror("failed to open distribution output file");
+		return false;
+	}
+
+	fprintf(fp, "scenario,counters,arrival_rate,service_mean,seed,percentile,wait_min\n");
+	for(size_t i=0; i<scenarios.size(); i++) {
+		Scenario *sc = &scenarios[i];
+
+		for(int p=0; p<=1000; p+=5) {
+			double pct = p / 10.0;
+			fprintf(fp, "%d,%d,%g,%g,%lu,%g,%.3f\n", (int)i, sc->counters, sc->arrival_rate,
+					sc->service_mean, sc->seed, pct, MIN(sc->wstat.get_percentile(pct)));
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static bool parse_list(const char *str, std::vector<double> *res)
+{
+	res->clear();
+
+	while(*str) {
+		char *endp;
+		double val = strtod(str, &endp);
+		if(endp == str || val <= 0.0 || (*endp && *endp != ',')) {
+			return false;
+		}
+		res->push_back(val);
+		str = *endp ? endp + 1 : endp;
+	}
+	return !res->empty();
+}
+
+static int parse_dist(const char *str)
+{
+	if(strcmp(str, "exp") == 0) return DIST_EXP;
+	if(strcmp(str, "fixed") == 0) return DIST_FIXED;
+	if(strcmp(str, "uniform") == 0) return DIST_UNIFORM;
+	return -1;
+}
+
+static const char *usage_fmt = "usage: %s [options]\n"
+	"options (lists are comma-separated, and every combination is simulated):\n"
+	"  -c <list>    number of counters serving customers (default: 2)\n"
+	"  -a <list>    customer arrivals per hour (default: 20)\n"
+	"  -s <list>    mean service time in minutes (default: 5)\n"
+	"  -A <dist>    arrival interval distribution: exp, fixed, uniform (default: exp)\n"
+	"  -S <dist>    service time distribution: exp, fixed, uniform (default: exp)\n"
+	"  -d <hours>   simulated duration of each scenario (default: 168, a week)\n"
+	"  -r <count>   repetitions of each scenario with different seeds (default: 1)\n"
+	"  -seed <n>    random seed of the first repetition (default: 1)\n"
+	"  -j <count>   number of threads (default: number of processors)\n"
+	"  -o <file>    write the wait time distributions to a CSV file\n"
+	"  -h           print usage and exit\n";
+
+static int proc_args(int argc, char **argv)
+{
+	parse_list("2", &opt_counters);
+	parse_list("20", &opt_rates);
+	parse_list("5", &opt_service);
+
+	for(int i=1; i<argc; i++) {
+		const char *opt = argv[i];
+
+		if(strcmp(opt, "-h") == 0) {
+			printf(usage_fmt, argv[0]);
+			exit(0);
+		}
+		if(opt[0] != '-' || i + 1 >= argc) {
+			fprintf(stderr, opt[0] == '-' ? "%s must be followed by a value\n" :
+					"unexpected argument: %s\n", opt);
+			return -1;
+		}
+		const char *val = argv[++i];
+
+		if(strcmp(opt, "-c") == 0 || strcmp(opt, "-a") == 0 || strcmp(opt, "-s") == 0) {
+			std::vector<double> *list = opt[1] == 'c' ? &opt_counters :
+				(opt[1] == 'a' ? &opt_rates : &opt_service);
+			if(!parse_list(val, list)) {
+				fprintf(stderr, "invalid list of values: %s\n", val);
+				return -1;
+			}
+
+		} else if(strcmp(opt, "-A") == 0 || strcmp(opt, "-S") == 0) {
+			int dist = parse_dist(val);
+			if(dist == -1) {
+				fprintf(stderr, "invalid distribution: %s\n", val);
+				return -1;
+			}
+			if(opt[1] == 'A') {
+				arrival_dist = dist;
+			} else {
+				service_dist = dist;
+			}
+
+		} else if(strcmp(opt, "-d") == 0) {
+			if((duration = atof(val)) <= 0.0) {
+				fprintf(stderr, "invalid duration: %s\n", val);
+				return -1;
+			}
+
+		} else if(strcmp(opt, "-r") == 0) {
+			if((num_reps = atoi(val)) <= 0) {
+				fprintf(stderr, "invalid repetition count: %s\n", val);
+				return -1;
+			}
+
+		} else if(strcmp(opt, "-seed") == 0) {
+			seed = strtoul(val, 0, 0);
+
+		} else if(strcmp(opt, "-j") == 0) {
+			if((num_threads = atoi(val)) <= 0) {
+				fprintf(stderr, "invalid thread count: %s\n", val);
+				return -1;
+			}
+
+		} else if(strcmp(opt, "-o") == 0) {
+			dist_fname = val;
+
+		} else {
+			fprintf(stderr, "invalid option: %s\n", opt);
+			return -1;
+		}
+	}
+	return 0;
+}
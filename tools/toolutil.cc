@@ -0,0 +1,96 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "toolutil.h"
+
+static std::string get_line(const std::string &str, size_t offs);
+
+uint64_t rand_next(uint64_t *rng)
+{
+	uint64_t x = *rng;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*rng = x;
+	return x * 0x2545f4914f6cdd1dull;
+}
+
+void collect_output(Device *dev, const char *buf, int len, void *cls)
+{
+	((std::string*)cls)->append(buf, len);
+}
+
+void print_diff(const std::string &expected, const std::string &actual,
+		const char *exp_name, const char *act_name)
+{
+	size_t offs = 0;
+	while(offs < expected.size() && offs < actual.size() && expected[offs] == actual[offs]) {
+		offs++;
+	}
+
+	int line = 1;
+	for(size_t i=0; i<offs; i++) {
+		if(expected[i] == '\n') line++;
+	}
+
+	printf("responses differ at byte %lu (line %d), %s %lu bytes, %s %lu bytes\n",
+			(unsigned long)offs, line, exp_name, (unsigned long)expected.size(),
+			act_name, (unsigned long)actual.size());
+
+	/* line the two up */
+	int width = strlen(exp_name) > strlen(act_name) ? strlen(exp_name) : strlen(act_name);
+	printf("  %s:%*s %s\n", exp_name, width - (int)strlen(exp_name), "", get_line(expected, offs).c_str());
+	printf("  %s:%*s %s\n", act_name, width - (int)strlen(act_name), "", get_line(actual, offs).c_str());
+}
+
+/* the line containing offs, with any non-printable characters escaped */
+static std::string get_line(const std::string &str, size_t offs)
+{
+	if(offs >= str.size()) {
+		return "<end>";
+	}
+
+	size_t start = str.rfind('\n', offs);
+	start = start == std::string::npos || start == offs ? 0 : start + 1;
+	if(offs - start > 60) {
+		start = offs - 60;
+	}
+
+	std::string res;
+	for(size_t i=start; i<str.size() && i < offs + 60; i++) {
+		unsigned char c = str[i];
+		if(c == '\n' && i > offs) break;
+
+		if(c >= 32 && c < 127 && c != '\\') {
+			res += c;
+		} else {
+			char buf[8];
+			switch(c) {
+			case '\n': strcpy(buf, "\\n"); break;
+			case '\r': strcpy(buf, "\\r"); break;
+			case '\\': strcpy(buf, "\\\\"); break;
+			default:
+				sprintf(buf, "\\x%02x", c);
+			}
+			res += buf;
+		}
+	}
+	return res;
+}
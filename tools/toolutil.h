@@ -0,0 +1,42 @@
+/*
+eqemu - electronic queue system emulator
+Copyright (C) 2014  John Tsiombikas <nuclear@member.fsf.org>,
+                    Eleni-Maria Stea <eleni@mutantstargoat.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* helpers shared by the tools which run devices in-process */
+#ifndef TOOLUTIL_H_
+#define TOOLUTIL_H_
+
+#include <string>
+#include <inttypes.h>
+
+class Device;
+
+/* xorshift64*, advances the state in *rng, which must not be 0. Every tool
+ * keeps its own state, so the results depend only on the seed.
+ */
+uint64_t rand_next(uint64_t *rng);
+
+/* Device output_func appending the output to the std::string in cls */
+void collect_output(Device *dev, const char *buf, int len, void *cls);
+
+/* prints where two response streams first differ, and the line around it in
+ * both, labelled with the names of the expected and actual stream
+ */
+void print_diff(const std::string &expected, const std::string &actual,
+		const char *exp_name, const char *act_name);
+
+#endif	/* TOOLUTIL_H_ */